@@ -0,0 +1,215 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-admission.c
+ * @brief   Connection limit and per source address rate limiting for aesdsocket
+ *
+ * Without limits one client could open any number of connections and grow
+ * receive buffers without bound while the others wait. Three checks prevent
+ * that, all off by default:
+ *   - config.max_connections caps the connections open at once.
+ *   - config.max_packet caps a packet, checked by framing before the receive
+ *     buffer grows.
+ *   - config.rate_bytes and config.rate_packets are per second token buckets
+ *     keyed on client_ip.
+ *
+ * Each bucket holds one second of tokens and refills continuously. Charges
+ * may push it below zero, but nothing more is read from that address until
+ * it is paid back. A single receive is capped at one bucket of bytes, so
+ * one charge never puts an address more than ADMISSION_MAX_DEFER_MS behind.
+ * A packet larger than the bucket is received over several paid-back reads
+ * instead of pushing the address past the cap. A
+ * connection thread sleeps for that. An event loop stops polling the
+ * connection for input and its timer wheel resumes it once the debt is paid.
+ * Either closes a connection more than ADMISSION_MAX_DEFER_MS behind. A new
+ * connection is rejected at accept, before anything is allocated for it,
+ * when the limit is reached or its address is that far behind.
+ *
+ * Addresses hash into ADMISSION_BUCKETS slots. A slot changes owner once the
+ * previous owner's bucket has refilled. Until then, addresses that collide
+ * share a bucket. That errs on the strict side and keeps the table fixed size.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#include <string.h>
+#include <time.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-admission.h"
+#include "aesd-stats.h"
+
+typedef struct admission_bucket
+{
+    pthread_mutex_t mutex;
+    char client_ip[INET_ADDRSTRLEN];    /* Owner of the slot */
+    double bytes;                       /* Tokens, negative while in debt */
+    double packets;
+    uint64_t updated;                   /* stats_now() of the last refill */
+} admission_bucket_t;
+
+static admission_bucket_t buckets[ADMISSION_BUCKETS];
+static pthread_once_t buckets_once = PTHREAD_ONCE_INIT;
+static atomic_int connections = 0;
+
+static void buckets_init(void)
+{
+    for (int i = 0; i < ADMISSION_BUCKETS; i++)
+    {
+        pthread_mutex_init(&buckets[i].mutex, NULL);
+    }
+}
+
+static bool rate_limited(void)
+{
+    return (config.rate_bytes > 0) || (config.rate_packets > 0);
+}
+
+/* FNV-1a of the address text */
+static unsigned int bucket_index(const char *client_ip)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *c = client_ip; *c != '\0'; c++)
+    {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return hash % ADMISSION_BUCKETS;
+}
+
+/* Lock the bucket of client_ip and refill it up to one second of tokens */
+static admission_bucket_t *bucket_lock(const char *client_ip)
+{
+    pthread_once(&buckets_once, buckets_init);
+    admission_bucket_t *bucket = &buckets[bucket_index(client_ip)];
+    uint64_t now = stats_now();
+
+    pthread_mutex_lock(&bucket->mutex);
+    double elapsed = (bucket->updated == 0) ? 1.0 : (double)(now - bucket->updated) / 1e9;
+    bucket->updated = now;
+
+    bucket->bytes += elapsed * config.rate_bytes;
+    if (bucket->bytes >= (double)config.rate_bytes)
+    {
+        bucket->bytes = config.rate_bytes;
+    }
+    bucket->packets += elapsed * config.rate_packets;
+    if (bucket->packets >= (double)config.rate_packets)
+    {
+        bucket->packets = config.rate_packets;
+    }
+
+    /* A full bucket carries no history, hand the slot over */
+    if ((strcmp(bucket->client_ip, client_ip) != 0) &&
+        (bucket->bytes == (double)config.rate_bytes) && (bucket->packets == (double)config.rate_packets))
+    {
+        strncpy(bucket->client_ip, client_ip, sizeof(bucket->client_ip) - 1);
+    }
+    return bucket;
+}
+
+uint64_t admission_delay(const char *client_ip)
+{
+    double wait = 0;
+
+    if (!rate_limited())
+    {
+        return 0;
+    }
+
+    admission_bucket_t *bucket = bucket_lock(client_ip);
+    if ((config.rate_bytes > 0) && (bucket->bytes < 0))
+    {
+        wait = -bucket->bytes / config.rate_bytes;
+    }
+    if ((config.rate_packets > 0) && (bucket->packets < 0) && (-bucket->packets / config.rate_packets > wait))
+    {
+        wait = -bucket->packets / config.rate_packets;
+    }
+    pthread_mutex_unlock(&bucket->mutex);
+
+    return (uint64_t)(wait * 1e9);
+}
+
+size_t admission_recv_size(size_t space)
+{
+    if ((config.rate_bytes > 0) && (space > (size_t)config.rate_bytes))
+    {
+        return config.rate_bytes;
+    }
+    return space;
+}
+
+void admission_charge(const char *client_ip, size_t bytes, unsigned int packets)
+{
+    if (!rate_limited())
+    {
+        return;
+    }
+
+    admission_bucket_t *bucket = bucket_lock(client_ip);
+    if (config.rate_bytes > 0)
+    {
+        bucket->bytes -= bytes;
+    }
+    if (config.rate_packets > 0)
+    {
+        bucket->packets -= packets;
+    }
+    pthread_mutex_unlock(&bucket->mutex);
+}
+
+bool admission_accept(const char *client_ip)
+{
+    if (admission_delay(client_ip) > (uint64_t)ADMISSION_MAX_DEFER_MS * 1000000ULL)
+    {
+        aesd_log(LOG_DEBUG, "admission: Rejected %s, over its rate", client_ip);
+        stats_add(STATS_REJECTED, 1);
+        return false;
+    }
+
+    int open = atomic_fetch_add(&connections, 1);
+    if ((config.max_connections > 0) && (open >= config.max_connections))
+    {
+        atomic_fetch_sub(&connections, 1);
+        aesd_log(LOG_DEBUG, "admission: Rejected %s, %d connections open", client_ip, open);
+        stats_add(STATS_REJECTED, 1);
+        return false;
+    }
+    return true;
+}
+
+void admission_release(void)
+{
+    atomic_fetch_sub(&connections, 1);
+}
+
+bool admission_wait(const char *client_ip)
+{
+    uint64_t delay = admission_delay(client_ip);
+
+    if (delay > (uint64_t)ADMISSION_MAX_DEFER_MS * 1000000ULL)
+    {
+        aesd_log(LOG_DEBUG, "admission: Closing %s, too far over its rate", client_ip);
+        stats_add(STATS_REJECTED, 1);
+        return false;
+    }
+    if (delay > 0)
+    {
+        struct timespec pause = { .tv_sec = delay / 1000000000ULL, .tv_nsec = delay % 1000000000ULL };
+        nanosleep(&pause, NULL);
+    }
+    return true;
+}
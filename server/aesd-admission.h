@@ -0,0 +1,65 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-admission.h
+ * @brief   Connection limit and per source address rate limiting for aesdsocket
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_ADMISSION_H
+#define AESD_ADMISSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADMISSION_BUCKETS (4096)            /* Token bucket slots, source addresses hash into them */
+#define ADMISSION_MAX_DEFER_MS (1000)       /* Longest wait for tokens, a client further behind is rejected */
+
+/**
+ * Admit a new connection from client_ip: under config.max_connections and
+ * not too far over its rate. Call before allocating anything for it.
+ * @return true if admitted, the connection then holds a slot until
+ * admission_release. A rejection is counted in the statistics.
+ */
+bool admission_accept(const char *client_ip);
+
+/**
+ * Give back the slot of an admitted connection that closed.
+ */
+void admission_release(void);
+
+/**
+ * @return how much of space one receive may fill, at most one bucket of bytes
+ * so that its charge is paid back within ADMISSION_MAX_DEFER_MS
+ */
+size_t admission_recv_size(size_t space);
+
+/**
+ * Charge bytes received and packets served to the bucket of client_ip.
+ */
+void admission_charge(const char *client_ip, size_t bytes, unsigned int packets);
+
+/**
+ * @return ns until client_ip is back within its rates, 0 if it is now
+ */
+uint64_t admission_delay(const char *client_ip);
+
+/**
+ * Defer a connection thread until client_ip is back within its rates.
+ * @return false, counted as a rejection, if that is more than
+ * ADMISSION_MAX_DEFER_MS away
+ */
+bool admission_wait(const char *client_ip);
+
+#endif /* AESD_ADMISSION_H */
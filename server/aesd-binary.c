@@ -0,0 +1,171 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-binary.c
+ * @brief   Length-prefixed binary record protocol for aesdsocket
+ *
+ * A connection whose first bytes are BINARY_MAGIC speaks records instead of
+ * newline terminated text. Every record starts with a fixed header carrying
+ * its type and payload length, so framing needs no scan over the payload and
+ * payloads may hold any byte, newlines included. An append stores its
+ * payload as is and the storage record index counts it as one packet, so
+ * seeks and retention treat it like any text packet. Replays answer with one
+ * DATA record whose length is known up front, so the log behind it goes out
+ * through the same sendfile, mmap or io_uring paths as a text replay.
+ *
+ * The text protocol is unchanged, a connection picks one or the other with
+ * its first bytes. Binary sessions are file backend only: a DATA record needs
+ * the replay length, which the char device does not report.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#include <string.h>
+#include <syslog.h>
+#include <arpa/inet.h>
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-binary.h"
+#include "aesd-storage.h"
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+
+static void put_u64(char *buf, uint64_t value)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        buf[i] = (char)(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+static uint64_t get_u64(const char *buf)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        value = (value << 8) | (uint8_t)buf[i];
+    }
+    return value;
+}
+
+static uint32_t get_u32(const char *buf)
+{
+    uint32_t value;
+    memcpy(&value, buf, sizeof(value));
+    return ntohl(value);
+}
+
+static void put_header(char *buf, binary_type_t type, uint32_t payload_len)
+{
+    uint32_t len = htonl(payload_len);
+    buf[0] = (char)type;
+    memset(buf + 1, 0, 3);
+    memcpy(buf + 4, &len, sizeof(len));
+}
+
+uint32_t binary_payload_length(const char *header)
+{
+    return get_u32(header + 4);
+}
+
+/* DATA header and start/end, the caller sends the log range behind them */
+static void reply_data(binary_reply_t *reply, off_t start, off_t end)
+{
+    /* Announce the real start, only a replay that begins at 0 can still move */
+    off_t from = (start == 0) ? storage_start() : start;
+    if (from > end)
+    {
+        from = end;
+    }
+
+    put_header(reply->buf, BINARY_DATA, 2 * sizeof(uint64_t) + (end - from));
+    put_u64(reply->buf + BINARY_HEADER_SIZE, from);
+    put_u64(reply->buf + BINARY_HEADER_SIZE + sizeof(uint64_t), end);
+    reply->len = BINARY_HEADER_SIZE + 2 * sizeof(uint64_t);
+    reply->replay_start = from;
+    reply->replay_end = end;
+}
+
+int binary_process(const char *record, size_t record_len, binary_reply_t *reply)
+{
+    uint32_t payload_len = binary_payload_length(record);
+    const char *payload = record + BINARY_HEADER_SIZE;
+    off_t start, end;
+
+    reply->len = 0;
+    reply->replay_start = 0;
+    reply->replay_end = 0;
+
+    /* Framing hands over only the header of a record above BINARY_MAX_PAYLOAD */
+    if (record_len != BINARY_HEADER_SIZE + (size_t)payload_len)
+    {
+        aesd_log(LOG_ERR, "binary: Record of %u bytes is too large", payload_len);
+        return ERROR;
+    }
+
+    switch ((uint8_t)record[0])
+    {
+        case BINARY_APPEND:
+            if (storage_append(payload, payload_len, &end) != 0)
+            {
+                aesd_log(LOG_ERR, "binary: Append failed");
+                return ERROR;
+            }
+            put_header(reply->buf, BINARY_OK, sizeof(uint64_t));
+            put_u64(reply->buf + BINARY_HEADER_SIZE, end);
+            reply->len = BINARY_HEADER_SIZE + sizeof(uint64_t);
+            return 0;
+
+        case BINARY_REPLAY:
+            if ((payload_len != sizeof(uint64_t)) || (get_u64(payload) > INT64_MAX) ||
+                (storage_resume((off_t)get_u64(payload), &start, &end) != 0))
+            {
+                break;
+            }
+            reply_data(reply, start, end);
+            return 0;
+
+        case BINARY_SEEK:
+            end = storage_end();
+            if ((payload_len != 2 * sizeof(uint32_t)) ||
+                (storage_locate(get_u32(payload), get_u32(payload + sizeof(uint32_t)), end, &start) != 0))
+            {
+                break;
+            }
+            reply_data(reply, start, end);
+            return 0;
+
+        case BINARY_STATS:
+        {
+            size_t len = stats_format(reply->buf + BINARY_HEADER_SIZE, reply->size - BINARY_HEADER_SIZE);
+            put_header(reply->buf, BINARY_STATS_REPORT, len);
+            reply->len = BINARY_HEADER_SIZE + len;
+            return 0;
+        }
+
+        default:
+            aesd_log(LOG_DEBUG, "binary: Unknown record type 0x%02x", (uint8_t)record[0]);
+            break;
+    }
+
+    put_header(reply->buf, BINARY_ERROR, 0);
+    reply->len = BINARY_HEADER_SIZE;
+    return 0;
+}
+
+bool binary_replay_intact(const binary_reply_t *reply)
+{
+    /* Retention moved the start of a replay from 0 forward if it dropped anything since */
+    return (reply->replay_start != 0) || (reply->replay_start == reply->replay_end) || (storage_start() == 0);
+}
+#endif
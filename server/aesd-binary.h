@@ -0,0 +1,83 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-binary.h
+ * @brief   Length-prefixed binary record protocol for aesdsocket
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_BINARY_H
+#define AESD_BINARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "aesdsocket.h"
+#include "aesd-stats.h"
+
+/* First bytes of a binary session, not text a line based client would send */
+#define BINARY_MAGIC "\xAE\x5D" "B1"
+#define BINARY_MAGIC_SIZE (4)
+
+/* Record header: type (1 byte), 3 reserved, payload length (4 bytes, network order) */
+#define BINARY_HEADER_SIZE (8)
+#define BINARY_MAX_PAYLOAD (16 * 1024 * 1024)
+#define BINARY_REPLY_SIZE (BINARY_HEADER_SIZE + STATS_REPORT_SIZE)
+
+typedef enum
+{
+    BINARY_APPEND = 0x01,           /* Bytes to append as one packet, answered by OK */
+    BINARY_REPLAY = 0x02,           /* u64 offset, answered by DATA from there */
+    BINARY_SEEK = 0x03,             /* u32 write_cmd, u32 write_cmd_offset, answered by DATA from there */
+    BINARY_STATS = 0x04,            /* Empty, answered by STATS_REPORT */
+    BINARY_OK = 0x81,               /* u64 end of the log after the append */
+    BINARY_DATA = 0x82,             /* u64 start, u64 end (the next resume offset), the log in [start, end) */
+    BINARY_STATS_REPORT = 0x84,     /* The stats_format text report */
+    BINARY_ERROR = 0xFF,            /* Empty, the request was malformed or out of range */
+} binary_type_t;
+
+/* Answer to one record: buf goes out first, then [replay_start, replay_end) of the log */
+typedef struct binary_reply
+{
+    char *buf;                      /* Caller provided, at least BINARY_REPLY_SIZE */
+    size_t size;
+    size_t len;
+    off_t replay_start;             /* 0 replays from the oldest packet kept */
+    off_t replay_end;
+} binary_reply_t;
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+/**
+ * @return the payload length of the record header at buf
+ */
+uint32_t binary_payload_length(const char *header);
+
+/**
+ * Execute one framed record. Malformed or out of range requests get an ERROR
+ * record, the session goes on.
+ * @param record the header and payload, record_len bytes
+ * @return 0 when reply is ready, ERROR if the connection must be closed
+ */
+int binary_process(const char *record, size_t record_len, binary_reply_t *reply);
+
+/**
+ * A DATA reply announces its length before the log is sent. A replay from
+ * offset 0 follows retention, so check afterwards that no segment was dropped
+ * under it.
+ * @return false if the DATA record sent may be shorter than announced
+ */
+bool binary_replay_intact(const binary_reply_t *reply);
+#endif
+
+#endif /* AESD_BINARY_H */
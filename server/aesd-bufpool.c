@@ -0,0 +1,252 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-bufpool.c
+ * @brief   Size-class receive buffer pool for aesdsocket
+ *
+ * Buffers come in power of two classes from 1 KB to 16 MB. Every thread keeps
+ * a small free list per class and takes from it without locking. A thread
+ * that exits (thread per connection mode) hands its cache to a shared depot,
+ * so the next connection thread still reuses the memory. Free buffers are
+ * linked through their first bytes.
+ *
+ * A running average of packet sizes picks the starting buffer size, so once
+ * traffic settles a connection neither mallocs nor reallocs.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "aesdsocket.h"
+#include "aesd-bufpool.h"
+
+#define BUFPOOL_EMA_SHIFT (4)   /* Packet size average weight, 1/16 per packet */
+
+typedef struct bufpool_free
+{
+    struct bufpool_free *next;
+} bufpool_free_t;
+
+typedef struct bufpool_cache
+{
+    bufpool_free_t *head[BUFPOOL_CLASSES];
+    size_t count[BUFPOOL_CLASSES];
+} bufpool_cache_t;
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t depot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bufpool_cache_t depot;
+
+/* Average packet size, racy updates only cost precision */
+static atomic_size_t packet_size_avg = BUF_INITIAL_SIZE;
+
+static size_t class_size(int class)
+{
+    return (size_t)1 << (class + BUFPOOL_MIN_SHIFT);
+}
+
+/* Class index for size bytes, or BUFPOOL_CLASSES if too big to pool */
+static int size_class(size_t size)
+{
+    int class = 0;
+    while ((class < BUFPOOL_CLASSES) && (class_size(class) < size))
+    {
+        class++;
+    }
+    return class;
+}
+
+static size_t class_limit(int class, size_t bytes, size_t max_count)
+{
+    size_t count = bytes / class_size(class);
+    if (count == 0)
+    {
+        count = 1;
+    }
+    return (count > max_count) ? max_count : count;
+}
+
+static bool cache_push(bufpool_cache_t *cache, int class, char *buf, size_t limit)
+{
+    if (cache->count[class] >= limit)
+    {
+        return false;
+    }
+    bufpool_free_t *node = (bufpool_free_t*)buf;
+    node->next = cache->head[class];
+    cache->head[class] = node;
+    cache->count[class]++;
+    return true;
+}
+
+static char *cache_pop(bufpool_cache_t *cache, int class)
+{
+    bufpool_free_t *node = cache->head[class];
+    if (node != NULL)
+    {
+        cache->head[class] = node->next;
+        cache->count[class]--;
+    }
+    return (char*)node;
+}
+
+/* Thread exit, keep what the depot has room for */
+static void cache_destroy(void *cache_struct)
+{
+    bufpool_cache_t *cache = (bufpool_cache_t*)cache_struct;
+    char *buf;
+    int class;
+
+    pthread_mutex_lock(&depot_mutex);
+    for (class = 0; class < BUFPOOL_CLASSES; class++)
+    {
+        size_t limit = class_limit(class, BUFPOOL_DEPOT_CLASS_BYTES, BUFPOOL_DEPOT_CLASS_COUNT);
+        while ((buf = cache_pop(cache, class)) != NULL)
+        {
+            if (!cache_push(&depot, class, buf, limit))
+            {
+                free(buf);
+            }
+        }
+    }
+    pthread_mutex_unlock(&depot_mutex);
+    free(cache);
+}
+
+static void cache_key_create(void)
+{
+    pthread_key_create(&cache_key, cache_destroy);
+}
+
+static bufpool_cache_t *thread_cache(void)
+{
+    pthread_once(&cache_key_once, cache_key_create);
+    bufpool_cache_t *cache = pthread_getspecific(cache_key);
+    if (cache == NULL)
+    {
+        cache = calloc(1, sizeof(bufpool_cache_t));
+        if ((cache != NULL) && (pthread_setspecific(cache_key, cache) != 0))
+        {
+            free(cache);
+            cache = NULL;
+        }
+    }
+    return cache;
+}
+
+char *bufpool_get(size_t min_size, size_t *size)
+{
+    int class = size_class(min_size);
+    char *buf = NULL;
+
+    if (class == BUFPOOL_CLASSES)
+    {
+        *size = min_size;
+        return malloc(min_size);
+    }
+    *size = class_size(class);
+
+    bufpool_cache_t *cache = thread_cache();
+    if (cache != NULL)
+    {
+        buf = cache_pop(cache, class);
+    }
+    if (buf == NULL)
+    {
+        pthread_mutex_lock(&depot_mutex);
+        buf = cache_pop(&depot, class);
+        pthread_mutex_unlock(&depot_mutex);
+    }
+    if (buf == NULL)
+    {
+        buf = malloc(*size);
+    }
+    return buf;
+}
+
+void bufpool_put(char *buf, size_t size)
+{
+    if (buf == NULL)
+    {
+        return;
+    }
+
+    int class = size_class(size);
+    if ((class == BUFPOOL_CLASSES) || (class_size(class) != size))
+    {
+        free(buf);
+        return;
+    }
+
+    bufpool_cache_t *cache = thread_cache();
+    if ((cache != NULL) && cache_push(cache, class, buf, class_limit(class, BUFPOOL_THREAD_CLASS_BYTES, BUFPOOL_THREAD_CLASS_COUNT)))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&depot_mutex);
+    bool kept = cache_push(&depot, class, buf, class_limit(class, BUFPOOL_DEPOT_CLASS_BYTES, BUFPOOL_DEPOT_CLASS_COUNT));
+    pthread_mutex_unlock(&depot_mutex);
+    if (!kept)
+    {
+        free(buf);
+    }
+}
+
+void bufpool_note_packet(size_t len)
+{
+    size_t avg = atomic_load_explicit(&packet_size_avg, memory_order_relaxed);
+    if (len >= avg)
+    {
+        avg += (len - avg) >> BUFPOOL_EMA_SHIFT;
+    }
+    else
+    {
+        avg -= (avg - len) >> BUFPOOL_EMA_SHIFT;
+    }
+    atomic_store_explicit(&packet_size_avg, avg, memory_order_relaxed);
+}
+
+size_t bufpool_default_size(void)
+{
+    size_t size = 2 * atomic_load_explicit(&packet_size_avg, memory_order_relaxed);
+    if (size < BUF_INITIAL_SIZE)
+    {
+        size = BUF_INITIAL_SIZE;
+    }
+    if (size > BUFPOOL_MAX_DEFAULT)
+    {
+        size = BUFPOOL_MAX_DEFAULT;
+    }
+    return class_size(size_class(size));
+}
+
+void bufpool_destroy(void)
+{
+    char *buf;
+    int class;
+
+    pthread_mutex_lock(&depot_mutex);
+    for (class = 0; class < BUFPOOL_CLASSES; class++)
+    {
+        while ((buf = cache_pop(&depot, class)) != NULL)
+        {
+            free(buf);
+        }
+    }
+    pthread_mutex_unlock(&depot_mutex);
+}
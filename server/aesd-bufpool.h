@@ -0,0 +1,63 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-bufpool.h
+ * @brief   Size-class receive buffer pool for aesdsocket
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_BUFPOOL_H
+#define AESD_BUFPOOL_H
+
+#include <stddef.h>
+
+#define BUFPOOL_MIN_SHIFT (10)                      /* Smallest class, 1 KB */
+#define BUFPOOL_MAX_SHIFT (24)                      /* Largest pooled class, 16 MB */
+#define BUFPOOL_CLASSES (BUFPOOL_MAX_SHIFT - BUFPOOL_MIN_SHIFT + 1)
+#define BUFPOOL_THREAD_CLASS_BYTES (256 * 1024)     /* Per class cache bound of one thread */
+#define BUFPOOL_THREAD_CLASS_COUNT (8)
+#define BUFPOOL_DEPOT_CLASS_BYTES (4 * 1024 * 1024) /* Per class bound of the shared depot */
+#define BUFPOOL_DEPOT_CLASS_COUNT (64)
+#define BUFPOOL_MAX_DEFAULT (1024 * 1024)           /* Cap on the adaptive starting size */
+
+/**
+ * Get a buffer of at least min_size bytes, rounded up to its size class. The
+ * contents are not zeroed.
+ * @param size set to the usable size of the buffer
+ * @return the buffer, or NULL if out of memory
+ */
+char *bufpool_get(size_t min_size, size_t *size);
+
+/**
+ * Return a buffer from bufpool_get. It is kept in the calling thread's cache,
+ * handed to the shared depot when that is full, or freed.
+ */
+void bufpool_put(char *buf, size_t size);
+
+/**
+ * Feed the size of a framed packet into the running packet size average.
+ */
+void bufpool_note_packet(size_t len);
+
+/**
+ * @return the starting receive buffer size, the class that fits twice the
+ * average packet, so steady traffic never grows a buffer
+ */
+size_t bufpool_default_size(void);
+
+/**
+ * Free every buffer held by the shared depot.
+ */
+void bufpool_destroy(void);
+
+#endif /* AESD_BUFPOOL_H */
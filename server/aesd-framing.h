@@ -0,0 +1,94 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-framing.h
+ * @brief   Incremental newline framing of the aesdsocket receive stream
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_FRAMING_H
+#define AESD_FRAMING_H
+
+#include <stddef.h>
+
+/* Protocol of a connection, picked by its first bytes */
+typedef enum
+{
+    FRAME_UNDECIDED = 0,
+    FRAME_TEXT,         /* Newline terminated packets */
+    FRAME_BINARY,       /* Length-prefixed records, see aesd-binary.h */
+} frame_protocol_t;
+
+/* Receive buffer carried across the packets of one connection */
+typedef struct frame_buffer
+{
+    char *data;
+    size_t size;
+    size_t start;       /* First byte of the next packet */
+    size_t len;         /* End of the received bytes */
+    size_t scanned;     /* Bytes in [start, scanned) hold no newline */
+    size_t want;        /* Bytes the next binary record needs, the buffer grows to fit at once */
+    frame_protocol_t protocol;
+} frame_buffer_t;
+
+/**
+ * Take an empty frame buffer from the buffer pool, sized for the packets seen
+ * so far.
+ * @return 0 on success, ERROR on failure
+ */
+int frame_buffer_init(frame_buffer_t *frame);
+
+/**
+ * Return the frame buffer memory to the buffer pool.
+ */
+void frame_buffer_free(frame_buffer_t *frame);
+
+/**
+ * Find the next complete packet. Only bytes not searched by an earlier call
+ * are scanned, so a packet arriving in many pieces costs linear time. The
+ * first call settles the protocol: after BINARY_MAGIC a packet is one binary
+ * record, header included, found from its length without any scan. A record
+ * above BINARY_MAX_PAYLOAD is returned as its header alone.
+ * @return the packet length including its newline, 0 if none is buffered yet
+ */
+size_t frame_next_packet(frame_buffer_t *frame);
+
+/**
+ * Take the packet found by frame_next_packet off the front of the buffer.
+ * Bytes past it stay buffered as the start of the next packet.
+ * @return the packet, valid until the next frame_recv_space call
+ */
+char *frame_consume(frame_buffer_t *frame, size_t packet_len);
+
+/**
+ * Make room to receive into: move a partial packet to the front and move to
+ * the next size class when the buffer is full.
+ * @param space set to the number of bytes that can be received
+ * @return where to receive, NULL if the buffer could not grow or the packet
+ * is already longer than config.max_packet
+ */
+char *frame_recv_space(frame_buffer_t *frame, size_t *space);
+
+/**
+ * Account for length bytes received at the frame_recv_space pointer.
+ */
+void frame_received(frame_buffer_t *frame, size_t length);
+
+/**
+ * Vectorised search for '\n' (AVX2 or SSE2 when the CPU has them, memchr
+ * otherwise). Embedded NUL bytes are data like any other.
+ * @return the first newline in [buf, buf + len), or NULL
+ */
+const char *frame_find_newline(const char *buf, size_t len);
+
+#endif /* AESD_FRAMING_H */
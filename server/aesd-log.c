@@ -0,0 +1,198 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-log.c
+ * @brief   Asynchronous ring buffered logging for aesdsocket
+ *
+ * Every syslog() call is a blocking send to /dev/log. With the per packet
+ * debug messages that dominated the request path. Now every thread formats
+ * into its own single producer ring, and one drain thread empties the rings
+ * to syslog every LOG_DRAIN_INTERVAL_MS. Logging on the request path is a
+ * vsnprintf and a release store. A thread that exits leaves its ring to the
+ * drain thread, which frees it once it is empty.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "aesdsocket.h"
+#include "aesd-log.h"
+
+typedef struct log_entry
+{
+    int level;
+    char msg[LOG_MSG_SIZE];
+} log_entry_t;
+
+/* Written by its thread only, read by the drain thread only */
+typedef struct log_ring
+{
+    _Atomic size_t head;            /* Next entry to write */
+    _Atomic size_t tail;            /* Next entry to drain */
+    atomic_bool retired;            /* Owner exited, free once drained */
+    log_entry_t entries[LOG_RING_ENTRIES];
+    LIST_ENTRY(log_ring) link;
+} log_ring_t;
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(ring_head, log_ring) rings = LIST_HEAD_INITIALIZER(rings);
+
+static pthread_t drain_thread;
+static atomic_bool running = false;
+static atomic_ulong dropped = 0;
+
+static void ring_retire(void *ring_struct)
+{
+    log_ring_t *ring = (log_ring_t*)ring_struct;
+    atomic_store_explicit(&ring->retired, true, memory_order_release);
+}
+
+static void ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_retire);
+}
+
+static log_ring_t *thread_ring(void)
+{
+    pthread_once(&ring_key_once, ring_key_create);
+    log_ring_t *ring = pthread_getspecific(ring_key);
+    if (ring == NULL)
+    {
+        ring = calloc(1, sizeof(log_ring_t));
+        if (ring == NULL)
+        {
+            return NULL;
+        }
+        if (pthread_setspecific(ring_key, ring) != 0)
+        {
+            free(ring);
+            return NULL;
+        }
+        pthread_mutex_lock(&rings_mutex);
+        LIST_INSERT_HEAD(&rings, ring, link);
+        pthread_mutex_unlock(&rings_mutex);
+    }
+    return ring;
+}
+
+void log_write(int level, const char *format, ...)
+{
+    va_list args;
+    log_ring_t *ring = atomic_load_explicit(&running, memory_order_acquire) ? thread_ring() : NULL;
+
+    va_start(args, format);
+    if (ring == NULL)
+    {
+        vsyslog(level, format, args);
+        va_end(args);
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING_ENTRIES)
+    {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        va_end(args);
+        return;
+    }
+
+    log_entry_t *entry = &ring->entries[head % LOG_RING_ENTRIES];
+    entry->level = level;
+    vsnprintf(entry->msg, sizeof(entry->msg), format, args);
+    va_end(args);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/* Empty every ring into syslog and free the rings of exited threads */
+static void drain_rings(void)
+{
+    log_ring_t *ring;
+    log_ring_t *tmp;
+
+    pthread_mutex_lock(&rings_mutex);
+    LIST_FOREACH_SAFE(ring, &rings, link, tmp)
+    {
+        /* Read retired first, a ring retired before the drain has no later writes */
+        bool retired = atomic_load_explicit(&ring->retired, memory_order_acquire);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+        while (tail != head)
+        {
+            log_entry_t *entry = &ring->entries[tail % LOG_RING_ENTRIES];
+            syslog(entry->level, "%s", entry->msg);
+            tail++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        if (retired)
+        {
+            LIST_REMOVE(ring, link);
+            free(ring);
+        }
+    }
+    pthread_mutex_unlock(&rings_mutex);
+
+    unsigned long lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (lost > 0)
+    {
+        syslog(LOG_WARNING, "log: Dropped %lu messages, ring full", lost);
+    }
+}
+
+static void *threadfn_drain(void *unused)
+{
+    struct timespec interval = { .tv_sec = 0, .tv_nsec = LOG_DRAIN_INTERVAL_MS * 1000000L };
+
+    while (atomic_load_explicit(&running, memory_order_acquire))
+    {
+        drain_rings();
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+int log_init(void)
+{
+    atomic_store(&running, true);
+    if (create_helper_thread(&drain_thread, threadfn_drain, NULL) != 0)
+    {
+        atomic_store(&running, false);
+        syslog(LOG_ERR, "log: Drain thread creation failed, logging synchronously");
+        return ERROR;
+    }
+    return 0;
+}
+
+void log_destroy(void)
+{
+    if (!atomic_exchange(&running, false))
+    {
+        return;
+    }
+    pthread_join(drain_thread, NULL);
+
+    /* Rings of live threads stay listed, their owners may still hold them */
+    drain_rings();
+}
@@ -0,0 +1,66 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-log.h
+ * @brief   Asynchronous ring buffered logging for aesdsocket
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_LOG_H
+#define AESD_LOG_H
+
+#include <syslog.h>
+#include "aesdsocket.h"
+
+/* Statements above this level are compiled out, e.g. -DAESD_LOG_COMPILE_LEVEL=LOG_INFO */
+#ifndef AESD_LOG_COMPILE_LEVEL
+#define AESD_LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+#define LOG_RING_ENTRIES (64)       /* Messages buffered per thread */
+#define LOG_MSG_SIZE (240)          /* Longer messages are truncated */
+#define LOG_DRAIN_INTERVAL_MS (20)
+
+/**
+ * syslog() replacement. Filtered at compile time and against config.log_level,
+ * then formatted into the calling thread's ring without a syscall. Before
+ * log_init and after log_destroy it goes straight to syslog.
+ */
+#define aesd_log(level, ...) \
+    do \
+    { \
+        if (((level) <= AESD_LOG_COMPILE_LEVEL) && ((level) <= config.log_level)) \
+        { \
+            log_write((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+/**
+ * Start the thread that drains every ring to syslog.
+ * @return 0 on success, ERROR if messages keep going straight to syslog
+ */
+int log_init(void);
+
+/**
+ * Stop the drain thread after flushing what is buffered. Later messages go
+ * straight to syslog.
+ */
+void log_destroy(void);
+
+/**
+ * Format one message into the calling thread's ring, use aesd_log instead.
+ * A full ring drops the message and counts it.
+ */
+void log_write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif /* AESD_LOG_H */
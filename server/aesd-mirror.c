@@ -0,0 +1,209 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-mirror.c
+ * @brief   In-memory append-only mirror of the aesdsocket data file
+ *
+ * The log is kept in fixed size segments, so byte offset N lives in segment
+ * N / MIRROR_SEGMENT_SIZE. Appends reach the mirror in log order: a writer
+ * copies its range once every writer ahead of it has committed, just before it
+ * advances the committed end of the file itself (or the committer does it for
+ * a whole batch). It then publishes the new length with a release store.
+ * Readers load the length once and send everything below it, which never
+ * changes again, so a replay takes no lock at all.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ * @references
+ * 1. https://man7.org/linux/man-pages/man2/sendmsg.2.html
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-mirror.h"
+
+#define MIRROR_IOV_MAX (64)
+#define MIRROR_LOAD_CHUNK (64 * 1024)
+
+static char **segments = NULL;
+static atomic_size_t published = 0;
+static atomic_bool enabled = false;
+
+int mirror_init(int file_fd)
+{
+    char *chunk = NULL;
+    ssize_t read_bytes;
+    off_t offset = 0;
+
+    segments = calloc(MIRROR_MAX_SEGMENTS, sizeof(char*));
+    if (segments == NULL)
+    {
+        aesd_log(LOG_ERR, "mirror: Malloc for segment table failed");
+        return ERROR;
+    }
+    atomic_store(&enabled, true);
+
+    chunk = malloc(MIRROR_LOAD_CHUNK);
+    if (chunk == NULL)
+    {
+        aesd_log(LOG_ERR, "mirror: Malloc for load buffer failed");
+        mirror_destroy();
+        return ERROR;
+    }
+
+    /* Pick up whatever history is already on disk */
+    while ((read_bytes = pread(file_fd, chunk, MIRROR_LOAD_CHUNK, offset)) > 0)
+    {
+        mirror_append(chunk, read_bytes);
+        offset += read_bytes;
+    }
+    free(chunk);
+
+    if ((read_bytes == ERROR) || !mirror_enabled())
+    {
+        aesd_log(LOG_ERR, "mirror: Failed to load %s", FILE_NAME);
+        mirror_destroy();
+        return ERROR;
+    }
+
+    aesd_log(LOG_INFO, "mirror: Loaded %ld bytes", (long)offset);
+    return 0;
+}
+
+void mirror_destroy(void)
+{
+    atomic_store(&enabled, false);
+    if (segments != NULL)
+    {
+        for (size_t i = 0; i < MIRROR_MAX_SEGMENTS; i++)
+        {
+            free(segments[i]);
+        }
+        free(segments);
+        segments = NULL;
+    }
+    atomic_store(&published, 0);
+}
+
+bool mirror_enabled(void)
+{
+    return atomic_load_explicit(&enabled, memory_order_acquire);
+}
+
+void mirror_append(const char *buf, size_t len)
+{
+    size_t length = atomic_load_explicit(&published, memory_order_relaxed);
+
+    if (!mirror_enabled())
+    {
+        return;
+    }
+
+    while (len > 0)
+    {
+        size_t index = length / MIRROR_SEGMENT_SIZE;
+        size_t seg_offset = length % MIRROR_SEGMENT_SIZE;
+        size_t copy = MIRROR_SEGMENT_SIZE - seg_offset;
+
+        if (index >= MIRROR_MAX_SEGMENTS)
+        {
+            aesd_log(LOG_ERR, "mirror: History exceeds the mirror, replaying from the file");
+            atomic_store(&enabled, false);
+            return;
+        }
+        if (segments[index] == NULL)
+        {
+            segments[index] = malloc(MIRROR_SEGMENT_SIZE);
+            if (segments[index] == NULL)
+            {
+                aesd_log(LOG_ERR, "mirror: Malloc for segment failed, replaying from the file");
+                atomic_store(&enabled, false);
+                return;
+            }
+        }
+
+        if (copy > len)
+        {
+            copy = len;
+        }
+        memcpy(segments[index] + seg_offset, buf, copy);
+        buf += copy;
+        len -= copy;
+        length += copy;
+    }
+
+    /* Publish only after the bytes are in place */
+    atomic_store_explicit(&published, length, memory_order_release);
+}
+
+size_t mirror_length(void)
+{
+    return atomic_load_explicit(&published, memory_order_acquire);
+}
+
+replay_status_t mirror_send(int client_fd, off_t *offset, off_t end)
+{
+    struct iovec iov[MIRROR_IOV_MAX];
+    struct msghdr msg;
+
+    while (*offset < end)
+    {
+        size_t position = *offset;
+        int iov_count = 0;
+
+        /* Gather the segments covering [offset, end) */
+        while ((iov_count < MIRROR_IOV_MAX) && (position < (size_t)end))
+        {
+            size_t seg_offset = position % MIRROR_SEGMENT_SIZE;
+            size_t len = MIRROR_SEGMENT_SIZE - seg_offset;
+            if (len > (size_t)end - position)
+            {
+                len = (size_t)end - position;
+            }
+            iov[iov_count].iov_base = segments[position / MIRROR_SEGMENT_SIZE] + seg_offset;
+            iov[iov_count].iov_len = len;
+            iov_count++;
+            position += len;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+
+        ssize_t sent = sendmsg(client_fd, &msg, MSG_NOSIGNAL | ((position < (size_t)end) ? MSG_MORE : 0));
+        if (sent == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return REPLAY_AGAIN;
+            }
+            aesd_log(LOG_ERR, "mirror: sendmsg failed: %s", strerror(errno));
+            return REPLAY_ERROR;
+        }
+        *offset += sent;
+    }
+
+    return REPLAY_DONE;
+}
@@ -0,0 +1,66 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-mirror.h
+ * @brief   In-memory append-only mirror of the aesdsocket data file
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_MIRROR_H
+#define AESD_MIRROR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "aesd-replay.h"
+
+#define MIRROR_SEGMENT_SIZE (256 * 1024)
+#define MIRROR_MAX_SEGMENTS (64 * 1024)     /* 16 GB of history */
+
+/**
+ * Enable the mirror and load the current contents of file_fd into it.
+ * @return 0 on success, ERROR if the mirror could not be set up
+ */
+int mirror_init(int file_fd);
+
+/**
+ * Free the mirror segments.
+ */
+void mirror_destroy(void);
+
+/**
+ * @return true when replays should be served from the mirror
+ */
+bool mirror_enabled(void);
+
+/**
+ * Copy an append that was just written to the file into the mirror. Call in
+ * log order, while holding the turn to commit the range.
+ * If the mirror runs out of memory it disables itself and replays go back to
+ * the file.
+ */
+void mirror_append(const char *buf, size_t len);
+
+/**
+ * @return the number of bytes published in the mirror
+ */
+size_t mirror_length(void);
+
+/**
+ * Send [*offset, end) from the mirror to client_fd as a scatter list with
+ * sendmsg(). No lock is needed, published bytes never change.
+ * @param offset start position, advanced by the number of bytes sent
+ */
+replay_status_t mirror_send(int client_fd, off_t *offset, off_t end);
+
+#endif /* AESD_MIRROR_H */
@@ -0,0 +1,273 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-pool.c
+ * @brief   Bounded worker thread pool with work-stealing for aesdsocket
+ *
+ * Every worker owns a fixed size deque. The owner takes the oldest task from
+ * the top of its deque so connections are served in arrival order, and an idle
+ * worker steals the newest task from the bottom of another worker's deque.
+ * A counting semaphore holds one post per queued task, so a worker only wakes
+ * when there is something to run.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ * @references
+ * 1. https://man7.org/linux/man-pages/man7/sem_overview.7.html
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-pool.h"
+
+typedef struct pool_task
+{
+    void (*fn)(void *);
+    void *arg;
+} pool_task_t;
+
+typedef struct pool_worker
+{
+    pthread_t thread_id;
+    int index;
+    aesd_pool_t *pool;
+    pthread_mutex_t lock;
+    pool_task_t tasks[POOL_DEQUE_CAPACITY];
+    size_t top;                 /* Index of the oldest task */
+    size_t count;               /* Number of queued tasks */
+} pool_worker_t;
+
+struct aesd_pool
+{
+    int num_workers;
+    int started;
+    pool_worker_t *workers;
+    sem_t pending;              /* One post per queued task, one per worker on shutdown */
+    atomic_int queued;          /* Tasks pushed and not yet taken */
+    atomic_bool stopping;
+    atomic_uint next_worker;    /* Round-robin submit position */
+};
+
+static bool deque_push(pool_worker_t *worker, const pool_task_t *task)
+{
+    bool pushed = false;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count < POOL_DEQUE_CAPACITY)
+    {
+        worker->tasks[(worker->top + worker->count) % POOL_DEQUE_CAPACITY] = *task;
+        worker->count++;
+        pushed = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return pushed;
+}
+
+/* Owner side, oldest task first */
+static bool deque_take(pool_worker_t *worker, pool_task_t *task)
+{
+    bool taken = false;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count > 0)
+    {
+        *task = worker->tasks[worker->top];
+        worker->top = (worker->top + 1) % POOL_DEQUE_CAPACITY;
+        worker->count--;
+        taken = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return taken;
+}
+
+/* Thief side, newest task first so it stays clear of the owner's end */
+static bool deque_steal(pool_worker_t *victim, pool_task_t *task)
+{
+    bool stolen = false;
+
+    if (pthread_mutex_trylock(&victim->lock) != 0)
+    {
+        return false;
+    }
+    if (victim->count > 0)
+    {
+        victim->count--;
+        *task = victim->tasks[(victim->top + victim->count) % POOL_DEQUE_CAPACITY];
+        stolen = true;
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    return stolen;
+}
+
+static bool worker_find_task(pool_worker_t *worker, pool_task_t *task)
+{
+    aesd_pool_t *pool = worker->pool;
+    int i;
+
+    /* A victim may be briefly locked, so keep sweeping while tasks are queued */
+    while (atomic_load(&pool->queued) > 0)
+    {
+        if (deque_take(worker, task))
+        {
+            atomic_fetch_sub(&pool->queued, 1);
+            return true;
+        }
+
+        for (i = 1; i < pool->num_workers; i++)
+        {
+            if (deque_steal(&pool->workers[(worker->index + i) % pool->num_workers], task))
+            {
+                atomic_fetch_sub(&pool->queued, 1);
+                return true;
+            }
+        }
+        sched_yield();
+    }
+
+    return false;
+}
+
+static void *threadfn_worker(void *pool_worker_struct)
+{
+    pool_worker_t *worker = (pool_worker_t*)pool_worker_struct;
+    pool_task_t task;
+
+    while (1)
+    {
+        if (sem_wait(&worker->pool->pending) != 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            aesd_log(LOG_ERR, "pool: sem_wait failed");
+            break;
+        }
+
+        if (worker_find_task(worker, &task))
+        {
+            task.fn(task.arg);
+        }
+        else if (atomic_load(&worker->pool->stopping))
+        {
+            /* Queue drained and a shutdown post consumed */
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+aesd_pool_t *pool_create(int num_workers)
+{
+    aesd_pool_t *pool = calloc(1, sizeof(aesd_pool_t));
+    if (pool == NULL)
+    {
+        aesd_log(LOG_ERR, "pool: Malloc for pool failed");
+        return NULL;
+    }
+
+    pool->num_workers = num_workers;
+    pool->workers = calloc(num_workers, sizeof(pool_worker_t));
+    if (pool->workers == NULL)
+    {
+        aesd_log(LOG_ERR, "pool: Malloc for workers failed");
+        free(pool);
+        return NULL;
+    }
+
+    if (sem_init(&pool->pending, 0, 0) != 0)
+    {
+        aesd_log(LOG_ERR, "pool: sem_init failed");
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < num_workers; i++)
+    {
+        pool->workers[i].index = i;
+        pool->workers[i].pool = pool;
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+    }
+
+    for (int i = 0; i < num_workers; i++)
+    {
+        if (create_helper_thread(&pool->workers[i].thread_id, threadfn_worker, (void*)&pool->workers[i]) != 0)
+        {
+            aesd_log(LOG_ERR, "pool: Worker thread creation failed");
+            pool_destroy(pool);
+            return NULL;
+        }
+        pool->started++;
+    }
+
+    aesd_log(LOG_INFO, "pool: Started %d workers", num_workers);
+    return pool;
+}
+
+bool pool_submit(aesd_pool_t *pool, void (*fn)(void *), void *arg)
+{
+    pool_task_t task = { .fn = fn, .arg = arg };
+    unsigned int start = atomic_fetch_add(&pool->next_worker, 1);
+
+    /* Count the task first so a worker never sees it queued but uncounted */
+    atomic_fetch_add(&pool->queued, 1);
+
+    /* Fall through to the next deque when the preferred one is full */
+    for (int i = 0; i < pool->num_workers; i++)
+    {
+        if (deque_push(&pool->workers[(start + i) % pool->num_workers], &task))
+        {
+            sem_post(&pool->pending);
+            return true;
+        }
+    }
+
+    atomic_fetch_sub(&pool->queued, 1);
+    return false;
+}
+
+void pool_destroy(aesd_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    atomic_store(&pool->stopping, true);
+    for (int i = 0; i < pool->started; i++)
+    {
+        sem_post(&pool->pending);
+    }
+    for (int i = 0; i < pool->started; i++)
+    {
+        pthread_join(pool->workers[i].thread_id, NULL);
+    }
+    for (int i = 0; i < pool->num_workers; i++)
+    {
+        pthread_mutex_destroy(&pool->workers[i].lock);
+    }
+
+    sem_destroy(&pool->pending);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,47 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-pool.h
+ * @brief   Bounded worker thread pool with work-stealing for aesdsocket
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_POOL_H
+#define AESD_POOL_H
+
+#include <stdbool.h>
+
+/* Maximum number of queued tasks per worker deque */
+#define POOL_DEQUE_CAPACITY (256)
+
+typedef struct aesd_pool aesd_pool_t;
+
+/**
+ * Pre-spawn num_workers threads, each with its own bounded task deque.
+ * @return the pool, or NULL on failure
+ */
+aesd_pool_t *pool_create(int num_workers);
+
+/**
+ * Queue fn(arg) on a worker. Tasks are spread round-robin across the worker
+ * deques; idle workers steal from the others.
+ * @return false if every deque is full and the task was not queued
+ */
+bool pool_submit(aesd_pool_t *pool, void (*fn)(void *), void *arg);
+
+/**
+ * Let the workers drain the queued tasks, then join and free them.
+ */
+void pool_destroy(aesd_pool_t *pool);
+
+#endif /* AESD_POOL_H */
@@ -0,0 +1,1017 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-reactor.c
+ * @brief   Epoll based event loop mode for aesdsocket
+ *
+ * Each event loop thread owns an epoll instance and the connections it accepted.
+ * A connection moves through RECV (read until a newline is framed), then the
+ * packet is appended to FILE_NAME, then REPLAY (stream FILE_NAME back without
+ * blocking) and is finally closed, the same exchange threadfn_server performs.
+ *
+ * By default the loops share the listening socket. With config.reuse_port
+ * every loop has its own SO_REUSEPORT listener on the same port and is
+ * pinned to a core. The kernel then spreads incoming connections over the
+ * loops and no two loops contend on one accept queue. All of them still
+ * append through the same ordered storage.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ * @references
+ * 1. https://man7.org/linux/man-pages/man7/epoll.7.html
+ * 2. https://man7.org/linux/man-pages/man2/eventfd.2.html
+ * 3. https://lwn.net/Articles/542629/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "queue.h"
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-reactor.h"
+#include "aesd-replay.h"
+#include "aesd-mirror.h"
+#include "aesd-storage.h"
+#include "aesd-framing.h"
+#include "aesd-timestamp.h"
+#include "aesd-stats.h"
+#include "aesd-bufpool.h"
+#include "aesd-binary.h"
+#include "aesd-admission.h"
+#include "aesd-timer.h"
+#include "../aesd-char-driver/aesd_ioctl.h"
+
+#define REACTOR_MAX_EVENTS (64)
+
+typedef enum
+{
+    CONN_STATE_RECV = 0,
+    CONN_STATE_REPLAY,
+    CONN_STATE_CLOSE,
+} conn_state_t;
+
+/* Per connection state machine */
+typedef struct reactor_conn
+{
+    int client_fd;
+    char client_ip[INET_ADDRSTRLEN];
+    conn_state_t state;
+    off_t replay_offset;                /* Next byte of FILE_NAME to send */
+    off_t replay_end;                   /* End of the log snapshot, -1 to replay up to end of file */
+    bool replay_pending;                /* Coalesced replay due at the end of the batch */
+    bool waiting_writable;              /* Registered for EPOLLOUT instead of EPOLLIN */
+    frame_buffer_t rx;                  /* Receive buffer and framing state */
+    bool replay_corked;                 /* TCP_CORK set for a large replay */
+    char *replay_buf;                   /* Gathered chunk of FILE_NAME being sent back, from the buffer pool */
+    size_t replay_buf_size;
+    size_t replay_len;
+    size_t replay_sent;
+    uint64_t replay_started;            /* stats_now() at the start of the replay, 0 when none runs */
+    off_t replay_from;                  /* replay_offset at the start of the replay */
+    char cursor[AESD_CURSOR_SIZE];      /* Resume cursor line sent after the replay */
+    size_t cursor_len;
+    size_t cursor_sent;
+    binary_reply_t reply;               /* Binary reply sent ahead of the replay, buffer kept for the session */
+    size_t reply_sent;
+    timer_entry_t timer;                /* Idle, write stall or deferral deadline, in the loop's wheel */
+    bool deferred;                      /* Over its rate, not read from until the timer fires */
+    bool peer_closed;                   /* Hangup seen while deferred, read up to end of stream once resumed */
+    LIST_ENTRY(reactor_conn) link;
+} reactor_conn_t;
+
+/* One event loop thread */
+typedef struct reactor_loop
+{
+    pthread_t thread_id;
+    int epoll_fd;
+    int stop_fd;
+    int listen_fd;
+    bool own_listener;                  /* SO_REUSEPORT listener of this loop, closed with it */
+    int timer_fd;                       /* Timestamp timer, only on the first loop */
+    int stats_fd;                       /* Statistics socket, only on the first loop */
+    LIST_HEAD(conn_head, reactor_conn) conns;
+    timer_wheel_t timers;               /* Connection deadlines, touched by this loop only */
+} reactor_loop_t;
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == ERROR)
+    {
+        return ERROR;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void conn_close(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    timer_cancel(&loop->timers, &conn->timer);
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->client_fd, NULL);
+    close(conn->client_fd);
+    aesd_log(LOG_DEBUG, "Closed connection from %s", conn->client_ip);
+    stats_add(STATS_CONNECTIONS_ACTIVE, -1);
+    admission_release();
+
+    LIST_REMOVE(conn, link);
+    frame_buffer_free(&conn->rx);
+    bufpool_put(conn->replay_buf, conn->replay_buf_size);
+    bufpool_put(conn->reply.buf, conn->reply.size);
+    free(conn);
+}
+
+/* Deadline for what the connection now waits on: the client's data, or room to send the replay */
+static void conn_timer_update(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    int timeout = conn->waiting_writable ? config.stall_timeout : config.idle_timeout;
+
+    if (conn->deferred)
+    {
+        /* The deferral deadline stands, the idle one starts once reading resumes */
+        return;
+    }
+    if (timeout > 0)
+    {
+        timer_arm(&loop->timers, &conn->timer, stats_now(), timeout * 1000);
+    }
+    else
+    {
+        timer_cancel(&loop->timers, &conn->timer);
+    }
+}
+
+static void conn_accept(reactor_loop_t *loop)
+{
+    struct sockaddr_storage their_addr;
+    socklen_t addr_size;
+    char client_ip[INET_ADDRSTRLEN];
+    int new_fd;
+
+    /* Drain the accept queue; other loops sharing the listener may win the race */
+    while (1)
+    {
+        addr_size = sizeof their_addr;
+        new_fd = accept(loop->listen_fd, (struct sockaddr *)&their_addr, &addr_size);
+        if (new_fd == ERROR)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                aesd_log(LOG_ERR, "reactor: Accept failed: %s", strerror(errno));
+            }
+            return;
+        }
+        stats_add(STATS_ACCEPTS, 1);
+        inet_ntop(their_addr.ss_family, &(((struct sockaddr_in*)&their_addr)->sin_addr), client_ip, sizeof(client_ip));
+        if (!admission_accept(client_ip))
+        {
+            close(new_fd);
+            continue;
+        }
+        stats_add(STATS_CONNECTIONS_ACTIVE, 1);
+
+        reactor_conn_t *conn = calloc(1, sizeof(reactor_conn_t));
+        if (conn == NULL)
+        {
+            aesd_log(LOG_ERR, "reactor: Malloc for connection failed");
+            close(new_fd);
+            stats_add(STATS_CONNECTIONS_ACTIVE, -1);
+            admission_release();
+            continue;
+        }
+
+        conn->client_fd = new_fd;
+        conn->state = CONN_STATE_RECV;
+        conn->timer.data = conn;
+        memcpy(conn->client_ip, client_ip, sizeof(conn->client_ip));
+        aesd_log(LOG_DEBUG, "Accepted connection from %s", conn->client_ip);
+        LIST_INSERT_HEAD(&loop->conns, conn, link);
+
+        if (frame_buffer_init(&conn->rx) != 0)
+        {
+            aesd_log(LOG_ERR, "reactor: Memory allocation failed for receiving buffer");
+            conn_close(loop, conn);
+            continue;
+        }
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn };
+        if ((set_nonblocking(new_fd) == ERROR) || (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, new_fd, &ev) == ERROR))
+        {
+            aesd_log(LOG_ERR, "reactor: Failed to register connection: %s", strerror(errno));
+            conn_close(loop, conn);
+            continue;
+        }
+        conn_timer_update(loop, conn);
+    }
+}
+
+/* Socket buffer full, resume the replay when writable */
+static void conn_wait_writable(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    struct epoll_event ev = { .events = EPOLLOUT | EPOLLRDHUP, .data.ptr = conn };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->client_fd, &ev) == ERROR)
+    {
+        conn->state = CONN_STATE_CLOSE;
+        return;
+    }
+    conn->waiting_writable = true;
+}
+
+/**
+ * Replay finished: send the resume cursor if one is due, then close or go back
+ * to reading the next packet.
+ * @return true if the socket is full and the cursor resumes on EPOLLOUT
+ */
+static bool conn_replay_done(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    while (conn->cursor_sent < conn->cursor_len)
+    {
+        ssize_t sent = send(conn->client_fd, conn->cursor + conn->cursor_sent, conn->cursor_len - conn->cursor_sent,
+                            MSG_NOSIGNAL);
+        if (sent == ERROR)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                conn_wait_writable(loop, conn);
+                return true;
+            }
+            aesd_log(LOG_ERR, "reactor: Send cursor failed: %s", strerror(errno));
+            conn->state = CONN_STATE_CLOSE;
+            return false;
+        }
+        conn->cursor_sent += sent;
+    }
+    conn->cursor_len = 0;
+    conn->cursor_sent = 0;
+#if (USE_AESD_CHAR_DEVICE == 0)
+    if ((conn->reply.len > 0) && !binary_replay_intact(&conn->reply))
+    {
+        aesd_log(LOG_ERR, "reactor: Retention cut a binary replay short");
+        conn->state = CONN_STATE_CLOSE;
+        return false;
+    }
+#endif
+    conn->reply.len = 0;
+    conn->reply_sent = 0;
+
+    /* A binary reply without a log range is no replay */
+    if (conn->replay_offset > conn->replay_from)
+    {
+        stats_add(STATS_BYTES_OUT, conn->replay_offset - conn->replay_from);
+        stats_record(STATS_REPLAY_LATENCY, stats_now() - conn->replay_started);
+    }
+    conn->replay_started = 0;
+    conn->replay_pending = false;
+    conn->replay_len = 0;
+    conn->replay_sent = 0;
+    bufpool_put(conn->replay_buf, conn->replay_buf_size);
+    conn->replay_buf = NULL;
+    if (conn->replay_corked)
+    {
+        /* Flush the tail of the replay */
+        replay_cork(conn->client_fd, false);
+        conn->replay_corked = false;
+    }
+
+    /* Binary sessions always last until the client closes */
+    if (!config.keep_alive && (conn->rx.protocol != FRAME_BINARY))
+    {
+        conn->state = CONN_STATE_CLOSE;
+        return false;
+    }
+
+    conn->state = CONN_STATE_RECV;
+    if (conn->waiting_writable)
+    {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn };
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->client_fd, &ev) == ERROR)
+        {
+            conn->state = CONN_STATE_CLOSE;
+            return false;
+        }
+        conn->waiting_writable = false;
+    }
+    return false;
+}
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+static replay_status_t conn_replay_span(void *arg, int file_fd, const char *file_map, off_t *offset, off_t end)
+{
+    reactor_conn_t *conn = (reactor_conn_t*)arg;
+    if (file_map != NULL)
+    {
+        return replay_mapped(conn->client_fd, file_map, offset, end);
+    }
+    return replay_zero_copy(conn->client_fd, file_fd, offset, end);
+}
+#endif
+
+/**
+ * Send as much of FILE_NAME back as the socket accepts without blocking.
+ * @return true if the socket is full and the replay resumes on EPOLLOUT
+ */
+static bool conn_replay(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    ssize_t read_bytes;
+    ssize_t sent;
+
+    if (conn->replay_started == 0)
+    {
+        conn->replay_started = stats_now();
+        conn->replay_from = (conn->replay_offset == 0) ? storage_start() : conn->replay_offset;
+        if (replay_should_cork(conn->replay_offset, conn->replay_end))
+        {
+            replay_cork(conn->client_fd, true);
+            conn->replay_corked = true;
+        }
+    }
+
+    /* Binary reply header first, the log range follows it */
+    while (conn->reply_sent < conn->reply.len)
+    {
+        bool more = (conn->reply.replay_start < conn->reply.replay_end);
+        sent = send(conn->client_fd, conn->reply.buf + conn->reply_sent, conn->reply.len - conn->reply_sent,
+                    MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (sent == ERROR)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                conn_wait_writable(loop, conn);
+                return true;
+            }
+            aesd_log(LOG_ERR, "reactor: Send reply failed: %s", strerror(errno));
+            conn->state = CONN_STATE_CLOSE;
+            return false;
+        }
+        conn->reply_sent += sent;
+    }
+
+    /* [replay_offset, replay_end) is published, nothing here takes a lock */
+    if (mirror_enabled() && (conn->replay_end >= 0) && ((off_t)mirror_length() >= conn->replay_end))
+    {
+        replay_status_t mirror_status = mirror_send(conn->client_fd, &conn->replay_offset, conn->replay_end);
+        if (mirror_status == REPLAY_AGAIN)
+        {
+            conn_wait_writable(loop, conn);
+            return true;
+        }
+        if (mirror_status == REPLAY_DONE)
+        {
+            return conn_replay_done(loop, conn);
+        }
+        conn->state = CONN_STATE_CLOSE;
+        return false;
+    }
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+    /* sendfile (or send from the mapping) straight from the page cache */
+    replay_status_t status = storage_replay_spans(&conn->replay_offset, conn->replay_end, conn_replay_span, conn);
+    if (status == REPLAY_AGAIN)
+    {
+        conn_wait_writable(loop, conn);
+        return true;
+    }
+    if (status == REPLAY_DONE)
+    {
+        return conn_replay_done(loop, conn);
+    }
+    if (status != REPLAY_UNSUPPORTED)
+    {
+        conn->state = CONN_STATE_CLOSE;
+        return false;
+    }
+#endif
+
+    if (conn->replay_buf == NULL)
+    {
+        conn->replay_buf = bufpool_get(config.replay_flush, &conn->replay_buf_size);
+        if (conn->replay_buf == NULL)
+        {
+            aesd_log(LOG_ERR, "reactor: Malloc for replay buffer failed");
+            conn->state = CONN_STATE_CLOSE;
+            return false;
+        }
+    }
+
+    while (1)
+    {
+        if (conn->replay_sent == conn->replay_len)
+        {
+            read_bytes = storage_gather(conn->replay_buf, conn->replay_buf_size, &conn->replay_offset, conn->replay_end);
+            if (read_bytes == 0)
+            {
+                /* Whole snapshot sent back */
+                return conn_replay_done(loop, conn);
+            }
+            if (read_bytes == ERROR)
+            {
+                conn->state = CONN_STATE_CLOSE;
+                return false;
+            }
+            conn->replay_len = read_bytes;
+            conn->replay_sent = 0;
+        }
+
+        /* More of a known sized snapshot follows, let TCP fill the segment */
+        bool more = (conn->replay_end >= 0) && (conn->replay_offset < conn->replay_end);
+        sent = send(conn->client_fd, conn->replay_buf + conn->replay_sent, conn->replay_len - conn->replay_sent,
+                    MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (sent == ERROR)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                conn_wait_writable(loop, conn);
+                return true;
+            }
+            aesd_log(LOG_ERR, "reactor: Send to client failed: %s", strerror(errno));
+            conn->state = CONN_STATE_CLOSE;
+            return false;
+        }
+        conn->replay_sent += sent;
+    }
+}
+
+/* Append a complete packet (or apply a seek, resume or binary command) and schedule the replay */
+static void conn_process_packet(reactor_loop_t *loop, reactor_conn_t *conn, size_t packet_len)
+{
+    char *packet = frame_consume(&conn->rx, packet_len);
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+    if (conn->rx.protocol == FRAME_BINARY)
+    {
+        if ((conn->reply.buf == NULL) && ((conn->reply.buf = bufpool_get(BINARY_REPLY_SIZE, &conn->reply.size)) == NULL))
+        {
+            aesd_log(LOG_ERR, "reactor: Malloc for binary reply failed");
+            conn->state = CONN_STATE_CLOSE;
+            return;
+        }
+        if (binary_process(packet, packet_len, &conn->reply) != 0)
+        {
+            conn->state = CONN_STATE_CLOSE;
+            return;
+        }
+        /* The reply goes out as a replay, of an empty range when there is no log to send */
+        conn->reply_sent = 0;
+        conn->replay_offset = conn->reply.replay_start;
+        conn->replay_end = conn->reply.replay_end;
+        conn->state = CONN_STATE_REPLAY;
+        return;
+    }
+#endif
+
+#if (USE_AESD_CHAR_DEVICE == 1)
+    if (strncmp(packet, AESD_SEEK_CMD, strlen(AESD_SEEK_CMD)) == 0)
+    {
+        struct aesd_seekto seekto;
+        packet[packet_len - 1] = '\0';
+        if (sscanf(packet, "AESDCHAR_IOCSEEKTO:%u,%u", &seekto.write_cmd, &seekto.write_cmd_offset) != 2)
+        {
+            aesd_log(LOG_ERR, "reactor: number of args != 2");
+            conn->state = CONN_STATE_CLOSE;
+            return;
+        }
+        /* Replay from the new position up to end of file, it also covers pending appends */
+        if (storage_seek(seekto.write_cmd, seekto.write_cmd_offset, &conn->replay_offset) != 0)
+        {
+            aesd_log(LOG_ERR, "reactor: ioctl failed");
+            conn->state = CONN_STATE_CLOSE;
+            return;
+        }
+        conn->replay_end = -1;
+        conn->state = CONN_STATE_REPLAY;
+        return;
+    }
+#else
+    if (strncmp(packet, AESD_RESUME_CMD, strlen(AESD_RESUME_CMD)) == 0)
+    {
+        long long offset;
+        packet[packet_len - 1] = '\0';
+        if ((sscanf(packet, AESD_RESUME_CMD "%lld", &offset) != 1) ||
+            (storage_resume(offset, &conn->replay_offset, &conn->replay_end) != 0))
+        {
+            aesd_log(LOG_ERR, "reactor: Invalid resume offset");
+            conn->state = CONN_STATE_CLOSE;
+            return;
+        }
+        /* Only the delta since offset, then the cursor to resume from next time */
+        conn->cursor_len = snprintf(conn->cursor, sizeof(conn->cursor), AESD_CURSOR_FMT, (long long)conn->replay_end);
+        conn->cursor_sent = 0;
+        conn->state = CONN_STATE_REPLAY;
+        return;
+    }
+#endif
+
+    if (storage_append(packet, packet_len, &conn->replay_end) != 0)
+    {
+        aesd_log(LOG_ERR, "reactor: Write to temp file failed");
+        conn->state = CONN_STATE_CLOSE;
+        return;
+    }
+
+    /* Replays read the log by offset, always from the start */
+    conn->replay_offset = 0;
+    if (config.keep_alive && config.coalesce_replay)
+    {
+        /* conn_receive starts the replay once no complete packet is left buffered */
+        conn->replay_pending = true;
+        return;
+    }
+    conn->state = CONN_STATE_REPLAY;
+}
+
+/**
+ * Stop reading from a client over its rate. Only a hangup is watched until
+ * the timer fires delay ns later and conn_timer_expired resumes it, and not
+ * even that once the client is known to have finished sending.
+ * @return false if the connection could not be deferred
+ */
+static bool conn_defer(reactor_loop_t *loop, reactor_conn_t *conn, uint64_t delay)
+{
+    struct epoll_event ev = { .events = conn->peer_closed ? 0 : EPOLLRDHUP, .data.ptr = conn };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->client_fd, &ev) == ERROR)
+    {
+        aesd_log(LOG_ERR, "reactor: Failed to defer the connection: %s", strerror(errno));
+        return false;
+    }
+    conn->deferred = true;
+    timer_arm(&loop->timers, &conn->timer, stats_now(), (delay + 999999ULL) / 1000000ULL);
+    return true;
+}
+
+/**
+ * Frame and process buffered packets, receiving more until the socket would
+ * block or a replay is due.
+ * @return true if the socket has no more data for now
+ */
+static bool conn_receive(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    ssize_t length;
+    size_t packet_len;
+    size_t space;
+    char *recv_ptr;
+    uint64_t delay;
+
+    while (conn->state == CONN_STATE_RECV)
+    {
+        packet_len = frame_next_packet(&conn->rx);
+        if (packet_len > 0)
+        {
+            admission_charge(conn->client_ip, 0, 1);
+            conn_process_packet(loop, conn, packet_len);
+            continue;
+        }
+        if (conn->replay_pending)
+        {
+            /* End of a pipelined batch, one replay covers all of it */
+            conn->state = CONN_STATE_REPLAY;
+            break;
+        }
+
+        /* A client over its rate is not read from until it is back within it, one too far behind is closed */
+        delay = admission_delay(conn->client_ip);
+        if (delay > (uint64_t)ADMISSION_MAX_DEFER_MS * 1000000ULL)
+        {
+            aesd_log(LOG_DEBUG, "reactor: Closing %s, too far over its rate", conn->client_ip);
+            stats_add(STATS_REJECTED, 1);
+            conn->state = CONN_STATE_CLOSE;
+            break;
+        }
+        if (delay > 0)
+        {
+            if (!conn_defer(loop, conn, delay))
+            {
+                conn->state = CONN_STATE_CLOSE;
+                break;
+            }
+            return true;
+        }
+
+        recv_ptr = frame_recv_space(&conn->rx, &space);
+        if (recv_ptr == NULL)
+        {
+            aesd_log(LOG_ERR, "reactor: No room to receive the packet");
+            conn->state = CONN_STATE_CLOSE;
+            break;
+        }
+        space = admission_recv_size(space);
+
+        length = recv(conn->client_fd, recv_ptr, space, 0);
+        if (length == ERROR)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+            {
+                return true;
+            }
+            aesd_log(LOG_ERR, "reactor: Receive failed: %s", strerror(errno));
+            conn->state = CONN_STATE_CLOSE;
+            break;
+        }
+        if (length == 0)
+        {
+            /* Peer closed, any partial packet is dropped */
+            conn->state = CONN_STATE_CLOSE;
+            break;
+        }
+        frame_received(&conn->rx, length);
+        stats_add(STATS_BYTES_IN, length);
+        admission_charge(conn->client_ip, length, 0);
+    }
+
+    return false;
+}
+
+static void conn_handle_event(reactor_loop_t *loop, reactor_conn_t *conn, uint32_t events)
+{
+    bool blocked = false;
+
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        conn->state = CONN_STATE_CLOSE;
+    }
+    else if (conn->deferred)
+    {
+        /* The client finished sending, whole packets may still be unread. Stop
+           watching the hangup, which stays pending, and read to end of stream once resumed */
+        struct epoll_event ev = { .events = 0, .data.ptr = conn };
+        conn->peer_closed = true;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->client_fd, &ev) == 0)
+        {
+            return;
+        }
+        aesd_log(LOG_ERR, "reactor: Failed to defer the connection: %s", strerror(errno));
+        conn->state = CONN_STATE_CLOSE;
+    }
+
+    /* Keep-alive connections cycle between receive and replay until one blocks */
+    while (!blocked && (conn->state != CONN_STATE_CLOSE))
+    {
+        if (conn->state == CONN_STATE_RECV)
+        {
+            blocked = conn_receive(loop, conn);
+        }
+        else
+        {
+            blocked = conn_replay(loop, conn);
+        }
+    }
+
+    if (conn->state == CONN_STATE_CLOSE)
+    {
+        conn_close(loop, conn);
+        return;
+    }
+    /* Blocked after progress, the deadline starts over */
+    conn_timer_update(loop, conn);
+}
+
+static void conn_timer_expired(timer_entry_t *timer, void *reactor_loop_struct)
+{
+    reactor_loop_t *loop = (reactor_loop_t*)reactor_loop_struct;
+    reactor_conn_t *conn = (reactor_conn_t*)timer->data;
+
+    if (conn->deferred)
+    {
+        /* Back within its rate, read from it again */
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn };
+        conn->deferred = false;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->client_fd, &ev) == ERROR)
+        {
+            aesd_log(LOG_ERR, "reactor: Failed to resume the connection: %s", strerror(errno));
+            conn_close(loop, conn);
+            return;
+        }
+        conn_handle_event(loop, conn, 0);
+        return;
+    }
+
+    aesd_log(LOG_DEBUG, "reactor: Connection from %s timed out", conn->client_ip);
+    stats_add(STATS_EXPIRED, 1);
+    conn_close(loop, conn);
+}
+
+static void *threadfn_event_loop(void *reactor_loop_struct)
+{
+    reactor_loop_t *loop = (reactor_loop_t*)reactor_loop_struct;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    bool running = true;
+    int num_events;
+    int i;
+
+    while (running)
+    {
+        num_events = epoll_wait(loop->epoll_fd, events, REACTOR_MAX_EVENTS, timer_poll_timeout(&loop->timers));
+        if (num_events == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            aesd_log(LOG_ERR, "reactor: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < num_events; i++)
+        {
+            if (events[i].data.ptr == &loop->stop_fd)
+            {
+                running = false;
+            }
+            else if (events[i].data.ptr == &loop->listen_fd)
+            {
+                conn_accept(loop);
+            }
+            else if (events[i].data.ptr == &loop->timer_fd)
+            {
+                timestamp_timer_fire(loop->timer_fd);
+            }
+            else if (events[i].data.ptr == &loop->stats_fd)
+            {
+                stats_serve(loop->stats_fd);
+            }
+            else
+            {
+                conn_handle_event(loop, (reactor_conn_t*)events[i].data.ptr, events[i].events);
+            }
+        }
+        timer_advance(&loop->timers, stats_now(), conn_timer_expired, loop);
+    }
+
+    /* Drop the connections still in flight */
+    while (!LIST_EMPTY(&loop->conns))
+    {
+        conn_close(loop, LIST_FIRST(&loop->conns));
+    }
+
+    return NULL;
+}
+
+static int reactor_loop_init(reactor_loop_t *loop, int listen_fd, int timer_fd, int stats_fd)
+{
+    loop->listen_fd = listen_fd;
+    loop->timer_fd = timer_fd;
+    loop->stats_fd = stats_fd;
+    LIST_INIT(&loop->conns);
+    timer_wheel_init(&loop->timers, stats_now());
+
+    loop->epoll_fd = epoll_create1(0);
+    if (loop->epoll_fd == ERROR)
+    {
+        aesd_log(LOG_ERR, "reactor: epoll_create1 failed: %s", strerror(errno));
+        goto reactor_loop_init_fail;
+    }
+
+    loop->stop_fd = eventfd(0, 0);
+    if (loop->stop_fd == ERROR)
+    {
+        aesd_log(LOG_ERR, "reactor: eventfd failed: %s", strerror(errno));
+        goto reactor_loop_init_fail;
+    }
+
+    struct epoll_event stop_ev = { .events = EPOLLIN, .data.ptr = &loop->stop_fd };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->stop_fd, &stop_ev) == ERROR)
+    {
+        aesd_log(LOG_ERR, "reactor: Failed to register stop event: %s", strerror(errno));
+        goto reactor_loop_init_fail;
+    }
+
+    /* EPOLLEXCLUSIVE wakes only one of the loops sharing a listener for each incoming connection */
+    struct epoll_event listen_ev = { .events = EPOLLIN | (loop->own_listener ? 0 : EPOLLEXCLUSIVE), .data.ptr = &loop->listen_fd };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_ev) == ERROR)
+    {
+        aesd_log(LOG_ERR, "reactor: Failed to register listener: %s", strerror(errno));
+        goto reactor_loop_init_fail;
+    }
+
+    if (timer_fd != -1)
+    {
+        struct epoll_event timer_ev = { .events = EPOLLIN, .data.ptr = &loop->timer_fd };
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, timer_fd, &timer_ev) == ERROR)
+        {
+            aesd_log(LOG_ERR, "reactor: Failed to register timestamp timer: %s", strerror(errno));
+            goto reactor_loop_init_fail;
+        }
+    }
+
+    if (stats_fd != -1)
+    {
+        struct epoll_event stats_ev = { .events = EPOLLIN, .data.ptr = &loop->stats_fd };
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, stats_fd, &stats_ev) == ERROR)
+        {
+            aesd_log(LOG_ERR, "reactor: Failed to register statistics socket: %s", strerror(errno));
+            goto reactor_loop_init_fail;
+        }
+    }
+
+    return 0;
+
+reactor_loop_init_fail:
+    return ERROR;
+}
+
+static void reactor_loop_destroy(reactor_loop_t *loop)
+{
+    if (loop->own_listener)
+    {
+        close(loop->listen_fd);
+    }
+    if (loop->stop_fd != -1)
+    {
+        close(loop->stop_fd);
+    }
+    if (loop->epoll_fd != -1)
+    {
+        close(loop->epoll_fd);
+    }
+}
+
+int reactor_reuse_port(int listen_fd)
+{
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) != 0)
+    {
+        aesd_log(LOG_ERR, "reactor: SO_REUSEPORT failed: %s", strerror(errno));
+        return ERROR;
+    }
+    return 0;
+}
+
+/* Another non-blocking listener in the SO_REUSEPORT group of listen_fd */
+static int reactor_listener_open(int listen_fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+
+    if (getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len) == ERROR)
+    {
+        aesd_log(LOG_ERR, "reactor: getsockname failed: %s", strerror(errno));
+        return ERROR;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == ERROR)
+    {
+        aesd_log(LOG_ERR, "reactor: socket failed: %s", strerror(errno));
+        return ERROR;
+    }
+    if ((setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) != 0) ||
+        (reactor_reuse_port(fd) != 0) ||
+        (bind(fd, (struct sockaddr*)&addr, addr_len) != 0) ||
+        (listen(fd, BACKLOG) != 0))
+    {
+        aesd_log(LOG_ERR, "reactor: Failed to open SO_REUSEPORT listener: %s", strerror(errno));
+        close(fd);
+        return ERROR;
+    }
+    return fd;
+}
+
+/* Pin loop index to the index-th CPU the process may run on */
+static void reactor_loop_pin(reactor_loop_t *loop, int index, cpu_set_t *allowed)
+{
+    int count = CPU_COUNT(allowed);
+    int nth = index % count;
+    int cpu;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, allowed) && (nth-- == 0))
+        {
+            break;
+        }
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(loop->thread_id, sizeof(set), &set) != 0)
+    {
+        aesd_log(LOG_ERR, "reactor: Failed to pin event loop %d to CPU %d", index, cpu);
+    }
+}
+
+int reactor_run(int listen_fd, int timer_fd, int stats_fd)
+{
+    cpu_set_t allowed;
+    int retval = 0;
+    int started = 0;
+    int i;
+    sigset_t block_mask, orig_mask;
+
+    reactor_loop_t *loops = calloc(config.event_loops, sizeof(reactor_loop_t));
+    if (loops == NULL)
+    {
+        aesd_log(LOG_ERR, "reactor: Malloc for event loops failed");
+        return ERROR;
+    }
+
+    if (set_nonblocking(listen_fd) == ERROR)
+    {
+        aesd_log(LOG_ERR, "reactor: Failed to make listener non-blocking");
+        retval = ERROR;
+        goto reactor_run_free;
+    }
+
+    /* Keep SIGINT/SIGTERM on this thread only, the loops never see them */
+    sigemptyset(&block_mask);
+    sigaddset(&block_mask, SIGINT);
+    sigaddset(&block_mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block_mask, &orig_mask);
+
+    for (i = 0; i < config.event_loops; i++)
+    {
+        loops[i].epoll_fd = -1;
+        loops[i].stop_fd = -1;
+    }
+
+    if (config.reuse_port && (sched_getaffinity(0, sizeof(allowed), &allowed) != 0))
+    {
+        aesd_log(LOG_ERR, "reactor: sched_getaffinity failed, event loops are not pinned");
+        CPU_ZERO(&allowed);
+    }
+
+    for (i = 0; i < config.event_loops; i++)
+    {
+        int loop_listen_fd = listen_fd;
+
+        /* The first loop keeps the main listener, the others open their own */
+        if (config.reuse_port && (i > 0))
+        {
+            loop_listen_fd = reactor_listener_open(listen_fd);
+            if (loop_listen_fd == ERROR)
+            {
+                retval = ERROR;
+                break;
+            }
+            loops[i].own_listener = true;
+        }
+        loops[i].listen_fd = loop_listen_fd;
+
+        if (reactor_loop_init(&loops[i], loop_listen_fd, (i == 0) ? timer_fd : -1, (i == 0) ? stats_fd : -1) != 0)
+        {
+            retval = ERROR;
+            break;
+        }
+        if (pthread_create(&loops[i].thread_id, NULL, threadfn_event_loop, (void*)&loops[i]) != 0)
+        {
+            aesd_log(LOG_ERR, "reactor: Event loop thread creation failed");
+            retval = ERROR;
+            break;
+        }
+        if (config.reuse_port && (CPU_COUNT(&allowed) > 0))
+        {
+            reactor_loop_pin(&loops[i], i, &allowed);
+        }
+        started++;
+    }
+
+    aesd_log(LOG_INFO, "reactor: Started %d event loops", started);
+
+    /* Wait for a signal unless startup failed */
+    while ((retval == 0) && !caught_signal)
+    {
+        sigsuspend(&orig_mask);
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        if (write(loops[i].stop_fd, &(uint64_t){1}, sizeof(uint64_t)) != sizeof(uint64_t))
+        {
+            aesd_log(LOG_ERR, "reactor: Failed to stop event loop %d", i);
+        }
+    }
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(loops[i].thread_id, NULL);
+    }
+    for (i = 0; i < config.event_loops; i++)
+    {
+        reactor_loop_destroy(&loops[i]);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &orig_mask, NULL);
+
+reactor_run_free:
+    free(loops);
+    return retval;
+}
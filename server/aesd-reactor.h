@@ -0,0 +1,42 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-reactor.h
+ * @brief   Epoll based event loop mode for aesdsocket
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_REACTOR_H
+#define AESD_REACTOR_H
+
+#include <pthread.h>
+
+/**
+ * Run config.event_loops epoll event loop threads serving connections on listen_fd
+ * until a signal is caught. Each loop accepts from the shared listening socket and
+ * drives its connections through non-blocking recv, framing, append and replay.
+ * @param listen_fd the bound and listening server socket
+ * @param timer_fd timestamp timer served by the first loop, or -1
+ * @param stats_fd statistics socket served by the first loop, or -1
+ * @return 0 on a clean shutdown, ERROR if the loops could not be started
+ */
+int reactor_run(int listen_fd, int timer_fd, int stats_fd);
+
+/**
+ * Set SO_REUSEPORT on the server socket before it is bound, so that with
+ * config.reuse_port every event loop can bind a listener of its own.
+ * @return 0 on success, ERROR on failure
+ */
+int reactor_reuse_port(int listen_fd);
+
+#endif /* AESD_REACTOR_H */
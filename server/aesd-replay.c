@@ -0,0 +1,255 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-replay.c
+ * @brief   Zero-copy replay of the aesdsocket data file to a client
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ * @references
+ * 1. https://man7.org/linux/man-pages/man2/sendfile.2.html
+ * 2. https://man7.org/linux/man-pages/man2/splice.2.html
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-replay.h"
+
+#define REPLAY_SENDFILE_CHUNK (1024 * 1024)
+#define REPLAY_SPLICE_CHUNK (64 * 1024)
+
+/* Set once the kernel refuses to splice from the storage fd */
+static atomic_bool zero_copy_unsupported = false;
+
+#if (USE_AESD_CHAR_DEVICE == 1)
+static pthread_key_t pipe_key;
+static pthread_once_t pipe_key_once = PTHREAD_ONCE_INIT;
+
+static void pipe_destroy(void *pipe_struct)
+{
+    int *pipe_fds = (int*)pipe_struct;
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    free(pipe_fds);
+}
+
+static void pipe_key_create(void)
+{
+    pthread_key_create(&pipe_key, pipe_destroy);
+}
+
+/* The calling thread's splice pipe, created on first use */
+static int *thread_pipe(void)
+{
+    pthread_once(&pipe_key_once, pipe_key_create);
+    int *pipe_fds = pthread_getspecific(pipe_key);
+    if (pipe_fds == NULL)
+    {
+        pipe_fds = malloc(2 * sizeof(int));
+        if (pipe_fds == NULL)
+        {
+            return NULL;
+        }
+        if (pipe(pipe_fds) != 0)
+        {
+            free(pipe_fds);
+            return NULL;
+        }
+        fcntl(pipe_fds[1], F_SETPIPE_SZ, REPLAY_SPLICE_CHUNK);
+        pthread_setspecific(pipe_key, pipe_fds);
+    }
+    return pipe_fds;
+}
+
+/* Data left in the pipe after a failed send would leak into the next replay */
+static void thread_pipe_discard(void)
+{
+    int *pipe_fds = pthread_getspecific(pipe_key);
+    if (pipe_fds != NULL)
+    {
+        pthread_setspecific(pipe_key, NULL);
+        pipe_destroy(pipe_fds);
+    }
+}
+
+static replay_status_t replay_splice(int client_fd, int file_fd, off_t *offset, off_t end)
+{
+    bool sent_any = false;
+    int *pipe_fds = thread_pipe();
+    if (pipe_fds == NULL)
+    {
+        return REPLAY_UNSUPPORTED;
+    }
+
+    while ((end < 0) || (*offset < end))
+    {
+        size_t count = REPLAY_SPLICE_CHUNK;
+        if ((end >= 0) && ((off_t)count > end - *offset))
+        {
+            count = end - *offset;
+        }
+
+        ssize_t in = splice(file_fd, offset, pipe_fds[1], NULL, count, SPLICE_F_MOVE);
+        if (in == 0)
+        {
+            return REPLAY_DONE;
+        }
+        if (in == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (!sent_any && ((errno == EINVAL) || (errno == ENOSYS)))
+            {
+                return REPLAY_UNSUPPORTED;
+            }
+            aesd_log(LOG_ERR, "replay: splice from file failed: %s", strerror(errno));
+            return REPLAY_ERROR;
+        }
+
+        while (in > 0)
+        {
+            ssize_t out = splice(pipe_fds[0], NULL, client_fd, NULL, in, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out == ERROR)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                aesd_log(LOG_ERR, "replay: splice to client failed: %s", strerror(errno));
+                thread_pipe_discard();
+                return REPLAY_ERROR;
+            }
+            in -= out;
+        }
+        sent_any = true;
+    }
+
+    return REPLAY_DONE;
+}
+#endif
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+static replay_status_t replay_sendfile(int client_fd, int file_fd, off_t *offset, off_t end)
+{
+    bool sent_any = false;
+
+    while ((end < 0) || (*offset < end))
+    {
+        size_t count = REPLAY_SENDFILE_CHUNK;
+        if ((end >= 0) && ((off_t)count > end - *offset))
+        {
+            count = end - *offset;
+        }
+
+        ssize_t sent = sendfile(client_fd, file_fd, offset, count);
+        if (sent == 0)
+        {
+            return REPLAY_DONE;
+        }
+        if (sent == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return REPLAY_AGAIN;
+            }
+            if (!sent_any && ((errno == EINVAL) || (errno == ENOSYS)))
+            {
+                return REPLAY_UNSUPPORTED;
+            }
+            aesd_log(LOG_ERR, "replay: sendfile failed: %s", strerror(errno));
+            return REPLAY_ERROR;
+        }
+        sent_any = true;
+    }
+
+    return REPLAY_DONE;
+}
+#endif
+
+replay_status_t replay_zero_copy(int client_fd, int file_fd, off_t *offset, off_t end)
+{
+    replay_status_t status;
+
+    if (atomic_load(&zero_copy_unsupported))
+    {
+        return REPLAY_UNSUPPORTED;
+    }
+
+#if (USE_AESD_CHAR_DEVICE == 1)
+    status = replay_splice(client_fd, file_fd, offset, end);
+#else
+    status = replay_sendfile(client_fd, file_fd, offset, end);
+#endif
+
+    if (status == REPLAY_UNSUPPORTED)
+    {
+        aesd_log(LOG_INFO, "replay: %s cannot be spliced, using the copy path", FILE_NAME);
+        atomic_store(&zero_copy_unsupported, true);
+    }
+
+    return status;
+}
+
+replay_status_t replay_mapped(int client_fd, const char *file_map, off_t *offset, off_t end)
+{
+    while (*offset < end)
+    {
+        /* Straight from the page cache pages of the mapping, no read() in between */
+        ssize_t sent = send(client_fd, file_map + *offset, end - *offset, MSG_NOSIGNAL);
+        if (sent == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return REPLAY_AGAIN;
+            }
+            aesd_log(LOG_ERR, "replay: Send from mapping failed: %s", strerror(errno));
+            return REPLAY_ERROR;
+        }
+        *offset += sent;
+    }
+
+    return REPLAY_DONE;
+}
+
+bool replay_should_cork(off_t offset, off_t end)
+{
+    /* Unknown size (char device) is left to the gathering copy path */
+    return (end >= 0) && ((size_t)(end - offset) > config.replay_flush);
+}
+
+void replay_cork(int client_fd, bool cork)
+{
+    setsockopt(client_fd, IPPROTO_TCP, TCP_CORK, &(int){cork ? 1 : 0}, sizeof(int));
+}
@@ -0,0 +1,63 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-replay.h
+ * @brief   Zero-copy replay of the aesdsocket data file to a client
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_REPLAY_H
+#define AESD_REPLAY_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define REPLAY_FLUSH_DEFAULT (64 * 1024)    /* Bytes gathered per send on the copy paths */
+
+typedef enum
+{
+    REPLAY_DONE = 0,        /* Everything up to the end of the file was sent */
+    REPLAY_AGAIN,           /* Non-blocking socket is full, call again when writable */
+    REPLAY_UNSUPPORTED,     /* Nothing sent, the fd cannot be spliced, use the copy path */
+    REPLAY_ERROR,
+} replay_status_t;
+
+/**
+ * Send [*offset, end) of file_fd to client_fd without copying through user
+ * space: sendfile() for the regular data file, splice() through a per-thread
+ * pipe for the char device (blocking sockets only).
+ * @param offset start position, advanced by the number of bytes sent
+ * @param end stop position, or -1 to send up to end of file
+ */
+replay_status_t replay_zero_copy(int client_fd, int file_fd, off_t *offset, off_t end);
+
+/**
+ * Send [*offset, end) of a file from its read-only mapping file_map, whose
+ * first byte is file offset 0. Every byte below end must be written.
+ * @param offset start position, advanced by the number of bytes sent
+ */
+replay_status_t replay_mapped(int client_fd, const char *file_map, off_t *offset, off_t end);
+
+/**
+ * @return true when [offset, end) is worth corking, larger than one
+ * config.replay_flush send
+ */
+bool replay_should_cork(off_t offset, off_t end);
+
+/**
+ * Set or clear TCP_CORK on client_fd. While corked the kernel only sends full
+ * segments, clearing it flushes the tail of the replay.
+ */
+void replay_cork(int client_fd, bool cork);
+
+#endif /* AESD_REPLAY_H */
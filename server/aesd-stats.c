@@ -0,0 +1,385 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-stats.c
+ * @brief   Live counters and latency histograms for aesdsocket
+ *
+ * Every thread updates its own shard of counters and histograms, so the hot
+ * path is a relaxed load and store with no lock and no shared cache line. A
+ * reader sums the shards. A thread that exits (thread per connection mode)
+ * folds its shard into a retired total, so nothing it counted is lost.
+ *
+ * Histograms are log-linear like HdrHistogram: values below 64 have exact
+ * buckets, above that each power of two is split into 32 buckets.
+ *
+ * The report is served on a local UNIX socket, read it with
+ *   socat - UNIX-CONNECT:/var/tmp/aesdsocket-stats
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ * @references
+ * 1. http://hdrhistogram.org/
+ * 2. https://man7.org/linux/man-pages/man7/unix.7.html
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "queue.h"
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-stats.h"
+
+#define STATS_SUB_COUNT (1 << STATS_SUB_BITS)
+#define STATS_HALF_COUNT (STATS_SUB_COUNT / 2)
+
+typedef struct stats_histogram_data
+{
+    _Atomic uint64_t buckets[STATS_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} stats_histogram_data_t;
+
+typedef struct stats_shard
+{
+    _Atomic int64_t counters[STATS_COUNTERS];
+    stats_histogram_data_t histograms[STATS_HISTOGRAMS];
+    LIST_ENTRY(stats_shard) link;
+} stats_shard_t;
+
+static const char *counter_names[STATS_COUNTERS] = {
+    "accepts", "connections_active", "bytes_in", "bytes_out", "admission_rejects",
+    "connections_expired",
+};
+static const char *histogram_names[STATS_HISTOGRAMS] = {
+    "packet_size_bytes", "lock_wait_ns", "append_latency_ns", "replay_latency_ns",
+    "commit_batch_appends", "sync_latency_ns",
+};
+
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+
+/* Shard list and retired totals, only touched by thread start/exit and readers */
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(shard_head, stats_shard) shards = LIST_HEAD_INITIALIZER(shards);
+static stats_shard_t retired;
+static uint64_t start_ns;
+
+/* Accept count at the start of the current rate window, under shards_mutex */
+static uint64_t rate_window_ns;
+static int64_t rate_window_accepts;
+static double accept_rate;
+
+/* Only the owning thread writes, a plain add published with a relaxed store */
+static inline void owner_add(_Atomic uint64_t *value, uint64_t delta)
+{
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+static inline uint64_t load(_Atomic uint64_t *value)
+{
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+static unsigned bucket_index(uint64_t value)
+{
+    if (value < STATS_SUB_COUNT)
+    {
+        return (unsigned)value;
+    }
+    if (value >= ((uint64_t)1 << STATS_MAX_BITS))
+    {
+        value = ((uint64_t)1 << STATS_MAX_BITS) - 1;
+    }
+    /* Keep the top STATS_SUB_BITS bits, the leading one is implied */
+    unsigned shift = (63 - __builtin_clzll(value)) - (STATS_SUB_BITS - 1);
+    unsigned top = (unsigned)(value >> shift);
+    return STATS_SUB_COUNT + (shift - 1) * STATS_HALF_COUNT + (top - STATS_HALF_COUNT);
+}
+
+/* Largest value that lands in bucket index */
+static uint64_t bucket_upper(unsigned index)
+{
+    if (index < STATS_SUB_COUNT)
+    {
+        return index;
+    }
+    unsigned shift = (index - STATS_SUB_COUNT) / STATS_HALF_COUNT + 1;
+    uint64_t top = (index - STATS_SUB_COUNT) % STATS_HALF_COUNT + STATS_HALF_COUNT;
+    return ((top + 1) << shift) - 1;
+}
+
+static void shard_merge(stats_shard_t *into, stats_shard_t *from)
+{
+    int i, h;
+    unsigned b;
+
+    for (i = 0; i < STATS_COUNTERS; i++)
+    {
+        atomic_fetch_add_explicit(&into->counters[i], atomic_load_explicit(&from->counters[i], memory_order_relaxed), memory_order_relaxed);
+    }
+    for (h = 0; h < STATS_HISTOGRAMS; h++)
+    {
+        stats_histogram_data_t *dst = &into->histograms[h];
+        stats_histogram_data_t *src = &from->histograms[h];
+        for (b = 0; b < STATS_BUCKETS; b++)
+        {
+            uint64_t n = load(&src->buckets[b]);
+            if (n != 0)
+            {
+                atomic_fetch_add_explicit(&dst->buckets[b], n, memory_order_relaxed);
+            }
+        }
+        atomic_fetch_add_explicit(&dst->count, load(&src->count), memory_order_relaxed);
+        atomic_fetch_add_explicit(&dst->sum, load(&src->sum), memory_order_relaxed);
+        if (load(&src->max) > load(&dst->max))
+        {
+            atomic_store_explicit(&dst->max, load(&src->max), memory_order_relaxed);
+        }
+    }
+}
+
+/* Thread exit, keep what it counted in the retired totals */
+static void shard_destroy(void *shard_struct)
+{
+    stats_shard_t *shard = (stats_shard_t*)shard_struct;
+
+    pthread_mutex_lock(&shards_mutex);
+    shard_merge(&retired, shard);
+    LIST_REMOVE(shard, link);
+    pthread_mutex_unlock(&shards_mutex);
+    free(shard);
+}
+
+static void shard_key_create(void)
+{
+    pthread_key_create(&shard_key, shard_destroy);
+}
+
+static stats_shard_t *thread_shard(void)
+{
+    pthread_once(&shard_key_once, shard_key_create);
+    stats_shard_t *shard = pthread_getspecific(shard_key);
+    if (shard == NULL)
+    {
+        shard = calloc(1, sizeof(stats_shard_t));
+        if (shard == NULL)
+        {
+            return NULL;
+        }
+        if (pthread_setspecific(shard_key, shard) != 0)
+        {
+            free(shard);
+            return NULL;
+        }
+        pthread_mutex_lock(&shards_mutex);
+        LIST_INSERT_HEAD(&shards, shard, link);
+        pthread_mutex_unlock(&shards_mutex);
+    }
+    return shard;
+}
+
+void stats_init(void)
+{
+    pthread_once(&shard_key_once, shard_key_create);
+    start_ns = stats_now();
+}
+
+uint64_t stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_add(stats_counter_t counter, int64_t delta)
+{
+    stats_shard_t *shard = thread_shard();
+    if (shard != NULL)
+    {
+        _Atomic int64_t *value = &shard->counters[counter];
+        atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + delta, memory_order_relaxed);
+    }
+}
+
+void stats_record(stats_histogram_t histogram, uint64_t value)
+{
+    stats_shard_t *shard = thread_shard();
+    if (shard == NULL)
+    {
+        return;
+    }
+
+    stats_histogram_data_t *data = &shard->histograms[histogram];
+    owner_add(&data->buckets[bucket_index(value)], 1);
+    owner_add(&data->count, 1);
+    owner_add(&data->sum, value);
+    if (value > load(&data->max))
+    {
+        atomic_store_explicit(&data->max, value, memory_order_relaxed);
+    }
+}
+
+static uint64_t percentile(stats_histogram_data_t *data, double pct)
+{
+    uint64_t count = load(&data->count);
+    uint64_t rank = (uint64_t)(pct / 100.0 * count + 0.5);
+    uint64_t seen = 0;
+    unsigned b;
+
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    for (b = 0; b < STATS_BUCKETS; b++)
+    {
+        seen += load(&data->buckets[b]);
+        if (seen >= rank)
+        {
+            uint64_t upper = bucket_upper(b);
+            return (upper < load(&data->max)) ? upper : load(&data->max);
+        }
+    }
+    return load(&data->max);
+}
+
+size_t stats_format(char *buf, size_t size)
+{
+    stats_shard_t *total = calloc(1, sizeof(stats_shard_t));
+    stats_shard_t *shard;
+    size_t len = 0;
+    int i;
+
+    if ((total == NULL) || (size == 0))
+    {
+        free(total);
+        return 0;
+    }
+
+    pthread_mutex_lock(&shards_mutex);
+    shard_merge(total, &retired);
+    LIST_FOREACH(shard, &shards, link)
+    {
+        shard_merge(total, shard);
+    }
+
+    uint64_t now = stats_now();
+    double uptime = (now - start_ns) / 1e9;
+    int64_t accepts = atomic_load(&total->counters[STATS_ACCEPTS]);
+
+    /* Rate since the previous report, reads closer together than the window share its last value */
+    if (rate_window_ns == 0)
+    {
+        rate_window_ns = start_ns;
+    }
+    if (now - rate_window_ns >= (uint64_t)STATS_RATE_WINDOW_MS * 1000000ULL)
+    {
+        accept_rate = (accepts - rate_window_accepts) / ((now - rate_window_ns) / 1e9);
+        rate_window_ns = now;
+        rate_window_accepts = accepts;
+    }
+    double rate = accept_rate;
+    pthread_mutex_unlock(&shards_mutex);
+
+    len += snprintf(buf + len, size - len, "uptime_s %.3f\n", uptime);
+    for (i = 0; (i < STATS_COUNTERS) && (len < size); i++)
+    {
+        len += snprintf(buf + len, size - len, "%s %lld\n", counter_names[i], (long long)atomic_load(&total->counters[i]));
+    }
+    if (len < size)
+    {
+        len += snprintf(buf + len, size - len, "accepts_per_s %.1f\n", rate);
+    }
+    for (i = 0; (i < STATS_HISTOGRAMS) && (len < size); i++)
+    {
+        stats_histogram_data_t *data = &total->histograms[i];
+        uint64_t count = load(&data->count);
+        len += snprintf(buf + len, size - len, "%s count=%llu mean=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu\n",
+                        histogram_names[i], (unsigned long long)count,
+                        (unsigned long long)((count > 0) ? load(&data->sum) / count : 0),
+                        (unsigned long long)percentile(data, 50), (unsigned long long)percentile(data, 90),
+                        (unsigned long long)percentile(data, 99), (unsigned long long)percentile(data, 99.9),
+                        (unsigned long long)load(&data->max));
+    }
+
+    free(total);
+    return (len < size) ? len : size - 1;
+}
+
+int stats_listen(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if ((path == NULL) || (path[0] == '\0'))
+    {
+        return -1;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        aesd_log(LOG_ERR, "stats: Socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd == ERROR)
+    {
+        aesd_log(LOG_ERR, "stats: socket failed: %s", strerror(errno));
+        return -1;
+    }
+
+    /* A stale socket from an earlier run would fail the bind */
+    unlink(path);
+    if ((bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(listen_fd, 4) != 0))
+    {
+        aesd_log(LOG_ERR, "stats: Failed to listen on %s: %s", path, strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+    return listen_fd;
+}
+
+void stats_serve(int listen_fd)
+{
+    char report[STATS_REPORT_SIZE];
+    int client_fd;
+
+    while ((client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) != ERROR)
+    {
+        size_t len = stats_format(report, sizeof(report));
+        /* The report fits the socket buffer, a reader never stalls the caller */
+        if (send(client_fd, report, len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)len)
+        {
+            aesd_log(LOG_ERR, "stats: Failed to send the report");
+        }
+        close(client_fd);
+    }
+}
+
+void stats_close(int listen_fd, const char *path)
+{
+    if (listen_fd != -1)
+    {
+        close(listen_fd);
+        unlink(path);
+    }
+}
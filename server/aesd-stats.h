@@ -0,0 +1,100 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-stats.h
+ * @brief   Live counters and latency histograms for aesdsocket
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_STATS_H
+#define AESD_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATS_SOCKET_PATH "/var/tmp/aesdsocket-stats"
+#define STATS_SUB_BITS (6)          /* 32 to 64 buckets per power of two, ~3% precision */
+#define STATS_MAX_BITS (40)         /* Values are clamped to 2^40, 18 minutes in ns */
+#define STATS_BUCKETS ((1 << STATS_SUB_BITS) + (STATS_MAX_BITS - STATS_SUB_BITS) * (1 << (STATS_SUB_BITS - 1)))
+#define STATS_REPORT_SIZE (4096)
+#define STATS_RATE_WINDOW_MS (1000)     /* Shortest window of the reported accept rate */
+
+typedef enum
+{
+    STATS_ACCEPTS = 0,
+    STATS_CONNECTIONS_ACTIVE,       /* Gauge, opened minus closed */
+    STATS_BYTES_IN,
+    STATS_BYTES_OUT,
+    STATS_REJECTED,                 /* Connections refused or closed by admission control */
+    STATS_EXPIRED,                  /* Connections closed by an idle or write stall timeout */
+    STATS_COUNTERS,
+} stats_counter_t;
+
+typedef enum
+{
+    STATS_PACKET_SIZE = 0,          /* Bytes */
+    STATS_LOCK_WAIT,                /* ns waiting for earlier appends or the device mutex */
+    STATS_APPEND_LATENCY,           /* ns in storage_append */
+    STATS_REPLAY_LATENCY,           /* ns from the start to the end of one replay */
+    STATS_COMMIT_BATCH,             /* Appends written per group commit batch */
+    STATS_SYNC_LATENCY,             /* ns per durability sync of the log */
+    STATS_HISTOGRAMS,
+} stats_histogram_t;
+
+/**
+ * Start the uptime clock and the per-thread counters. Call once from main
+ * before any thread records statistics.
+ */
+void stats_init(void);
+
+/**
+ * Add delta to a counter of the calling thread, no lock or atomic RMW.
+ */
+void stats_add(stats_counter_t counter, int64_t delta);
+
+/**
+ * Record one value in a histogram of the calling thread.
+ */
+void stats_record(stats_histogram_t histogram, uint64_t value);
+
+/**
+ * @return CLOCK_MONOTONIC in ns, the time base of the latency histograms
+ */
+uint64_t stats_now(void);
+
+/**
+ * Sum every thread's counters into a text report, one "name value" line per
+ * counter and one line of percentiles per histogram. accepts_per_s is the
+ * rate since the previous report, over at least STATS_RATE_WINDOW_MS.
+ * @return the report length, truncated to size - 1
+ */
+size_t stats_format(char *buf, size_t size);
+
+/**
+ * Create the non-blocking UNIX listening socket the report is served on.
+ * @return the socket, or -1 when path is empty or the socket failed
+ */
+int stats_listen(const char *path);
+
+/**
+ * Called when the stats socket is readable: send the report to every pending
+ * client and close them.
+ */
+void stats_serve(int listen_fd);
+
+/**
+ * Close the stats socket and remove its path.
+ */
+void stats_close(int listen_fd, const char *path);
+
+#endif /* AESD_STATS_H */
@@ -0,0 +1,1378 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-storage.c
+ * @brief   Ordered appends and lock-free replays of the aesdsocket data log
+ *
+ * File mode appends use two counters instead of a mutex held across I/O:
+ * reserved_end hands out offsets with a fetch-add, and committed_end is the
+ * prefix of the log that is fully written. A writer pwrites at its reserved
+ * offset, waits for the writers ahead of it to commit, then commits its own
+ * range (and copies it into the mirror) while it holds the turn. The wait
+ * usually lasts a few yields. A writer ahead may be descheduled or stuck in
+ * the filesystem though, so after STORAGE_SPIN_LIMIT yields it sleeps until
+ * a commit wakes it. A replay reads committed_end once and streams [0, end)
+ * with pread, so a slow client never blocks an append.
+ *
+ * FILE_NAME is opened once at startup and every worker shares that descriptor.
+ * Nothing depends on its file position: appends and replays both pass explicit
+ * offsets, and a char-device seek command resolves its position on a private
+ * descriptor.
+ *
+ * With config.segment_size set, the file backend is a series of fixed size
+ * segment files FILE_NAME.000000, FILE_NAME.000001, ... instead. Log offset o
+ * lives in segment o / segment_size, so an append that crosses a boundary is
+ * split over two pwrites. Like the aesdchar ring, only a bounded history is
+ * kept: the oldest segment is unlinked once the log holds more than
+ * retain_bytes or retain_segments, or once its newest packet is retain_age
+ * old. Replays start at the first whole packet kept. A segment stays open
+ * while a replay reads from it.
+ *
+ * Packets are stored as is, so text replays see exactly the bytes that were
+ * sent. Their boundaries live in a record index instead: the end offset of
+ * every append, pushed in commit order. Seeks and retention look packets up
+ * there rather than scanning for newlines, so a binary payload may hold any
+ * byte. The index costs one off_t per packet kept.
+ *
+ * With config.use_mmap the file is also mapped read-only, so a replay sends
+ * from the page cache without a pread per chunk. FILE_NAME gets a mapping
+ * twice the size it needs, a larger one as the log outgrows it. Replaced
+ * mappings stay valid for readers still on them until storage_destroy.
+ * Segments are fixed size and mapped whole when they are created. A failed
+ * append is still committed so later writers can move on, which can leave
+ * committed_end past the end of a file. Touching a mapping there raises
+ * SIGBUS, so after any failed append replays read through the descriptor,
+ * which stops at the end of the file.
+ *
+ * With config.group_commit, appending threads do not write at all. They push
+ * a request onto a lock-free stack and sleep. One committer thread takes the
+ * whole stack at once, restores arrival order, and writes up to
+ * STORAGE_GROUP_MAX appends with a single pwritev (one per segment crossed).
+ * It then mirrors and commits the batch and wakes its waiters. Under load
+ * the syscalls per append fall with the batch size, and no writer spins
+ * waiting for another to commit.
+ *
+ * The committer is also where config.durability is applied. It fdatasyncs
+ * the files holding the unsynced part of the log every
+ * STORAGE_SYNC_INTERVAL_MS, or after every batch, or after every append by
+ * committing batches of one. Between interval syncs, sync_file_range starts
+ * writeback of each batch so the next fdatasync has less to wait for. Appends
+ * normally return once written. With config.sync_strict they return only
+ * once a sync covers them. Either way the caller sleeps, so parse_args keeps
+ * group commit and durability out of epoll mode.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ * @references
+ * 1. https://man7.org/linux/man-pages/man2/mmap.2.html
+ * 2. https://man7.org/linux/man-pages/man2/madvise.2.html
+ * 3. https://man7.org/linux/man-pages/man2/pwritev.2.html
+ * 4. https://man7.org/linux/man-pages/man2/fdatasync.2.html
+ * 5. https://man7.org/linux/man-pages/man2/sync_file_range.2.html
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-storage.h"
+#include "aesd-mirror.h"
+#include "aesd-stats.h"
+#include "../aesd-char-driver/aesd_ioctl.h"
+
+static int storage_fd_shared = -1;
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+static atomic_llong reserved_end = 0;
+static atomic_llong committed_end = 0;
+static atomic_bool append_failed = false;                       /* The files may end before committed_end */
+static atomic_int turn_sleepers = 0;                            /* Writers asleep on commit_turn */
+static pthread_mutex_t turn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commit_turn = PTHREAD_COND_INITIALIZER;    /* committed_end advanced */
+
+typedef struct storage_segment
+{
+    int fd;
+    char *map;                  /* Whole segment, read-only, NULL without config.use_mmap */
+    unsigned long long index;
+    time_t created;
+    int refs;                   /* Appends and replays using fd */
+    bool dropped;               /* Unlinked, fd is closed with the last reference */
+} storage_segment_t;
+
+/* Segment table, slot index % STORAGE_MAX_SEGMENTS */
+static pthread_mutex_t segments_mutex = PTHREAD_MUTEX_INITIALIZER;
+static storage_segment_t *segments[STORAGE_MAX_SEGMENTS];
+static unsigned long long first_segment;        /* Oldest kept */
+static unsigned long long next_segment;         /* One past the newest */
+static atomic_llong log_start = 0;              /* First kept packet */
+static atomic_llong oldest_expiry = LLONG_MAX;  /* When age retention next applies */
+
+/* Record index, the packets kept are record_ends[records_head] onwards */
+static pthread_mutex_t records_mutex = PTHREAD_MUTEX_INITIALIZER;
+static off_t *record_ends;          /* End offset of each packet, oldest first */
+static size_t records_head;         /* Entries dropped with their segments, compacted away as the array fills */
+static size_t records_count;        /* Entries from records_head on */
+static size_t records_capacity;
+static off_t records_start;         /* Start of the oldest packet kept */
+static bool records_lost = false;   /* An entry could not be stored, packets can no longer be counted */
+
+/* Read-only mappings of FILE_NAME, newest first */
+typedef struct storage_map
+{
+    char *base;
+    size_t size;
+    struct storage_map *prev;       /* Replaced, unmapped by storage_destroy */
+} storage_map_t;
+
+static pthread_mutex_t map_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic(storage_map_t*) file_map = NULL;
+
+/* One append waiting for the committer, lives on the appending thread's stack */
+typedef struct storage_request
+{
+    const char *buf;
+    size_t len;
+    off_t end;                      /* Set by the committer */
+    int status;
+    bool done;                      /* Under commit_mutex */
+    struct storage_request *next;   /* Older request while queued */
+} storage_request_t;
+
+/* Pending appends, newest first, pushed with a CAS and taken whole by the committer */
+static _Atomic(storage_request_t*) commit_queue = NULL;
+static pthread_mutex_t commit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commit_wakeup;                            /* Queue no longer empty, or stopping */
+static pthread_cond_t commit_done = PTHREAD_COND_INITIALIZER;    /* A batch was committed or synced */
+static pthread_t committer_thread;
+static bool committer_running = false;                          /* Under commit_mutex */
+static off_t synced_end = 0;    /* Durable prefix of the log, written by the committer under commit_mutex */
+#else
+/* The driver completes a command per newline, concurrent partial writes must not interleave */
+static pthread_mutex_t device_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int storage_open(void)
+{
+    /* No O_APPEND, appends land at their reserved offset through pwrite */
+    int fd = open(FILE_NAME, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    if (fd == ERROR)
+    {
+        aesd_log(LOG_ERR, "storage: Failed to open %s: %s", FILE_NAME, strerror(errno));
+    }
+    return fd;
+}
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+static void segment_path(unsigned long long index, char *path, size_t size)
+{
+    snprintf(path, size, "%s.%06llu", FILE_NAME, index);
+}
+
+/* mmap read-only with sequential readahead, NULL when that fails */
+static char *storage_map(int fd, size_t size)
+{
+    char *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        aesd_log(LOG_ERR, "storage: mmap failed, replaying without it: %s", strerror(errno));
+        return NULL;
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+    return base;
+}
+
+/**
+ * A mapping of FILE_NAME covering [0, end). Pages past the end of the file are
+ * mapped but never touched, so the mapping is replaced only as the log grows.
+ * @return the mapping, or NULL to replay from the descriptor
+ */
+static const char *storage_map_covering(off_t end)
+{
+    storage_map_t *map = atomic_load_explicit(&file_map, memory_order_acquire);
+
+    if ((map != NULL) && ((off_t)map->size >= end))
+    {
+        return map->base;
+    }
+
+    pthread_mutex_lock(&map_mutex);
+    map = atomic_load_explicit(&file_map, memory_order_relaxed);
+    if ((map == NULL) || ((off_t)map->size < end))
+    {
+        size_t size = (map != NULL) ? map->size : STORAGE_MAP_INITIAL;
+        while ((off_t)size < end)
+        {
+            size *= 2;
+        }
+
+        storage_map_t *grown = malloc(sizeof(storage_map_t));
+        char *base = (grown != NULL) ? storage_map(storage_fd_shared, size) : NULL;
+        if (base == NULL)
+        {
+            free(grown);
+            pthread_mutex_unlock(&map_mutex);
+            return NULL;
+        }
+        grown->base = base;
+        grown->size = size;
+        grown->prev = map;
+        atomic_store_explicit(&file_map, grown, memory_order_release);
+        map = grown;
+    }
+    pthread_mutex_unlock(&map_mutex);
+
+    return map->base;
+}
+
+/* Index a committed packet ending at end, called in commit order */
+static void record_push(off_t end)
+{
+    pthread_mutex_lock(&records_mutex);
+    if (!records_lost && (records_head + records_count == records_capacity))
+    {
+        if (records_head > 0)
+        {
+            /* Reuse the room of dropped entries before growing */
+            memmove(record_ends, record_ends + records_head, records_count * sizeof(off_t));
+            records_head = 0;
+        }
+        else
+        {
+            size_t capacity = (records_capacity > 0) ? records_capacity * 2 : STORAGE_RECORDS_INITIAL;
+            off_t *grown = realloc(record_ends, capacity * sizeof(off_t));
+            if (grown == NULL)
+            {
+                aesd_log(LOG_ERR, "storage: Malloc for the record index failed, seeks are refused from now on");
+                records_lost = true;
+            }
+            else
+            {
+                record_ends = grown;
+                records_capacity = capacity;
+            }
+        }
+    }
+    if (!records_lost)
+    {
+        record_ends[records_head + records_count] = end;
+        records_count++;
+    }
+    pthread_mutex_unlock(&records_mutex);
+}
+
+/**
+ * Forget the packets that start below base, whose segment was dropped.
+ * @return the start of the oldest packet left, the new log_start
+ */
+static off_t record_drop_before(off_t base)
+{
+    pthread_mutex_lock(&records_mutex);
+    while ((records_count > 0) && (records_start < base))
+    {
+        records_start = record_ends[records_head];
+        records_head++;
+        records_count--;
+    }
+    /* Without the index the committed end is the only boundary known */
+    off_t start = records_lost ? atomic_load(&committed_end) : records_start;
+    pthread_mutex_unlock(&records_mutex);
+    return start;
+}
+
+/**
+ * Find packet n, counted from the oldest kept, within the log below end.
+ * @return 0 with [start, packet_end) set, ERROR if there is no such packet
+ */
+static int record_find(unsigned int n, off_t end, off_t *start, off_t *packet_end)
+{
+    int retval = ERROR;
+
+    pthread_mutex_lock(&records_mutex);
+    if (!records_lost && (n < records_count) && (record_ends[records_head + n] <= end))
+    {
+        *start = (n == 0) ? records_start : record_ends[records_head + n - 1];
+        *packet_end = record_ends[records_head + n];
+        retval = 0;
+    }
+    pthread_mutex_unlock(&records_mutex);
+    return retval;
+}
+
+/* Index a log left over from an earlier run, whose packet boundaries were not kept, one packet per line */
+static void records_load(int fd, off_t size)
+{
+    char buf[STORAGE_LOCATE_CHUNK];
+    off_t offset = 0;
+    ssize_t read_bytes;
+
+    while ((offset < size) && ((read_bytes = pread(fd, buf, sizeof(buf), offset)) > 0))
+    {
+        for (const char *scan = buf; (scan = memchr(scan, '\n', buf + read_bytes - scan)) != NULL; scan++)
+        {
+            record_push(offset + (scan - buf) + 1);
+        }
+        offset += read_bytes;
+    }
+    if ((records_count == 0) || (record_ends[records_head + records_count - 1] < size))
+    {
+        /* An unterminated tail still counts as one packet */
+        record_push(size);
+    }
+}
+
+static void segment_release_locked(storage_segment_t *seg)
+{
+    if ((--seg->refs == 0) && seg->dropped)
+    {
+        if (seg->map != NULL)
+        {
+            munmap(seg->map, config.segment_size);
+        }
+        close(seg->fd);
+        free(seg);
+    }
+}
+
+/* Unlink the oldest segment, its readers keep the open file until they finish */
+static void segment_drop_oldest_locked(void)
+{
+    char path[PATH_MAX];
+    storage_segment_t *seg = segments[first_segment % STORAGE_MAX_SEGMENTS];
+
+    segment_path(first_segment, path, sizeof(path));
+    unlink(path);
+    segments[first_segment % STORAGE_MAX_SEGMENTS] = NULL;
+    first_segment++;
+    atomic_store(&log_start, record_drop_before((off_t)(first_segment * config.segment_size)));
+
+    /* Release the table's reference */
+    seg->dropped = true;
+    segment_release_locked(seg);
+}
+
+/* Drop whole segments past the retention limits, never the one being appended to */
+static void segment_retention_locked(void)
+{
+    off_t end = atomic_load_explicit(&committed_end, memory_order_acquire);
+    unsigned long long active = (end > 0) ? (unsigned long long)((end - 1) / config.segment_size) : 0;
+    time_t now = time(NULL);
+
+    while (first_segment < active)
+    {
+        /* A segment's newest packet is as old as its successor */
+        storage_segment_t *sealed = segments[(first_segment + 1) % STORAGE_MAX_SEGMENTS];
+        bool over_count = (next_segment - first_segment) > (unsigned long long)config.retain_segments;
+        bool over_bytes = (config.retain_bytes > 0) &&
+                          (end - (off_t)((first_segment + 1) * config.segment_size) >= config.retain_bytes);
+        bool over_age = (config.retain_age > 0) && (now - sealed->created >= config.retain_age);
+
+        if (!over_count && !over_bytes && !over_age)
+        {
+            break;
+        }
+        segment_drop_oldest_locked();
+    }
+
+    long long expiry = LLONG_MAX;
+    if ((config.retain_age > 0) && (first_segment + 1 < next_segment))
+    {
+        expiry = segments[(first_segment + 1) % STORAGE_MAX_SEGMENTS]->created + config.retain_age;
+    }
+    atomic_store(&oldest_expiry, expiry);
+}
+
+/* fsync the directory of FILE_NAME so a new segment's entry survives a crash */
+static void sync_directory(void)
+{
+    char dir[PATH_MAX];
+
+    snprintf(dir, sizeof(dir), "%s", FILE_NAME);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL)
+    {
+        snprintf(dir, sizeof(dir), ".");
+    }
+    else
+    {
+        slash[(slash == dir) ? 1 : 0] = '\0';
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if ((fd == ERROR) || (fsync(fd) != 0))
+    {
+        aesd_log(LOG_ERR, "storage: Failed to sync %s: %s", dir, strerror(errno));
+    }
+    if (fd != ERROR)
+    {
+        close(fd);
+    }
+}
+
+static int segment_create_locked(void)
+{
+    char path[PATH_MAX];
+
+    /* The slot is taken by a segment STORAGE_MAX_SEGMENTS older, the table bounds the history too */
+    if (next_segment - first_segment == STORAGE_MAX_SEGMENTS)
+    {
+        segment_drop_oldest_locked();
+    }
+
+    storage_segment_t *seg = calloc(1, sizeof(storage_segment_t));
+    if (seg == NULL)
+    {
+        return ERROR;
+    }
+
+    segment_path(next_segment, path, sizeof(path));
+    seg->fd = open(path, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    if (seg->fd == ERROR)
+    {
+        aesd_log(LOG_ERR, "storage: Failed to open %s: %s", path, strerror(errno));
+        free(seg);
+        return ERROR;
+    }
+    if (config.use_mmap)
+    {
+        /* Mapped ahead of the file, only the written prefix is ever read */
+        seg->map = storage_map(seg->fd, config.segment_size);
+    }
+    if (config.durability != DURABILITY_NONE)
+    {
+        sync_directory();
+    }
+    seg->index = next_segment;
+    seg->created = time(NULL);
+    seg->refs = 1;      /* Held by the table until dropped */
+    segments[next_segment % STORAGE_MAX_SEGMENTS] = seg;
+    next_segment++;
+
+    segment_retention_locked();
+    return 0;
+}
+
+/**
+ * Take a reference on segment index, creating it (and any before it) for an
+ * append when create is set.
+ * @return the segment, or NULL if it was dropped or could not be created
+ */
+static storage_segment_t *segment_get(unsigned long long index, bool create)
+{
+    storage_segment_t *seg = NULL;
+
+    pthread_mutex_lock(&segments_mutex);
+    if (index < first_segment)
+    {
+        goto segment_get_exit;
+    }
+    while (create && (index >= next_segment))
+    {
+        if (segment_create_locked() != 0)
+        {
+            goto segment_get_exit;
+        }
+    }
+    if (index < next_segment)
+    {
+        seg = segments[index % STORAGE_MAX_SEGMENTS];
+        seg->refs++;
+    }
+
+segment_get_exit:
+    pthread_mutex_unlock(&segments_mutex);
+    return seg;
+}
+
+static void segment_put(storage_segment_t *seg)
+{
+    pthread_mutex_lock(&segments_mutex);
+    segment_release_locked(seg);
+    pthread_mutex_unlock(&segments_mutex);
+}
+
+/* Reference the oldest segment and move *offset to its first packet, in one step with retention */
+static storage_segment_t *segment_get_oldest(off_t *offset)
+{
+    storage_segment_t *seg = NULL;
+
+    pthread_mutex_lock(&segments_mutex);
+    *offset = atomic_load(&log_start);
+    unsigned long long index = *offset / config.segment_size;
+    if (index < next_segment)
+    {
+        seg = segments[index % STORAGE_MAX_SEGMENTS];
+        seg->refs++;
+    }
+    pthread_mutex_unlock(&segments_mutex);
+    return seg;
+}
+
+/* pwrite [offset, offset + len) of the log into the segments it spans */
+static int segment_write(const char *buf, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        unsigned long long index = offset / config.segment_size;
+        off_t seg_offset = offset - (off_t)(index * config.segment_size);
+        size_t piece = config.segment_size - seg_offset;
+        if (piece > len)
+        {
+            piece = len;
+        }
+
+        storage_segment_t *seg = segment_get(index, true);
+        if (seg == NULL)
+        {
+            return ERROR;
+        }
+
+        size_t written = 0;
+        while (written < piece)
+        {
+            ssize_t ret = pwrite(seg->fd, buf + written, piece - written, seg_offset + written);
+            if (ret == ERROR)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                aesd_log(LOG_ERR, "storage: pwrite failed: %s", strerror(errno));
+                segment_put(seg);
+                return ERROR;
+            }
+            written += ret;
+        }
+        segment_put(seg);
+
+        buf += piece;
+        len -= piece;
+        offset += piece;
+    }
+    return 0;
+}
+
+/* Drop segments past the limits once an append from offset crossed into a new one or one aged out */
+static void storage_retain(off_t offset, size_t len)
+{
+    if ((config.segment_size > 0) && (len > 0) &&
+        (((offset / config.segment_size) != ((offset + (off_t)len - 1) / config.segment_size)) ||
+         ((long long)time(NULL) >= atomic_load(&oldest_expiry))))
+    {
+        pthread_mutex_lock(&segments_mutex);
+        segment_retention_locked();
+        pthread_mutex_unlock(&segments_mutex);
+    }
+}
+
+/* pwritev all of iov at offset, resuming after short writes, iov is consumed */
+static int pwritev_all(int fd, struct iovec *iov, int iovcnt, off_t offset)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t ret = pwritev(fd, iov, iovcnt, offset);
+        if (ret == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            aesd_log(LOG_ERR, "storage: pwritev failed: %s", strerror(errno));
+            return ERROR;
+        }
+        offset += ret;
+        while ((iovcnt > 0) && ((size_t)ret >= iov->iov_len))
+        {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return 0;
+}
+
+/* pwritev len bytes into one file, starting their writeback when an interval sync follows */
+static int group_write_file(int fd, struct iovec *iov, int iovcnt, off_t offset, size_t len)
+{
+    if (pwritev_all(fd, iov, iovcnt, offset) != 0)
+    {
+        return ERROR;
+    }
+    if (config.durability == DURABILITY_INTERVAL)
+    {
+        sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
+    }
+    return 0;
+}
+
+/* Write a batch of len bytes at offset of the log, one pwritev per file it lands in */
+static int group_write(struct iovec *iov, int iovcnt, off_t offset, size_t len)
+{
+    struct iovec piece[STORAGE_GROUP_MAX];
+
+    if (config.segment_size == 0)
+    {
+        return group_write_file(storage_fd_shared, iov, iovcnt, offset, len);
+    }
+
+    for (int next = 0; next < iovcnt; )
+    {
+        unsigned long long index = offset / config.segment_size;
+        off_t seg_offset = offset - (off_t)(index * config.segment_size);
+        size_t room = config.segment_size - seg_offset;
+        size_t piece_len = 0;
+        int count = 0;
+
+        /* Entries up to the segment boundary, the one crossing it is split */
+        while ((next < iovcnt) && (room > 0))
+        {
+            piece[count] = iov[next];
+            if (iov[next].iov_len > room)
+            {
+                piece[count].iov_len = room;
+                iov[next].iov_base = (char*)iov[next].iov_base + room;
+                iov[next].iov_len -= room;
+            }
+            else
+            {
+                next++;
+            }
+            room -= piece[count].iov_len;
+            piece_len += piece[count].iov_len;
+            count++;
+        }
+        if (piece_len == 0)
+        {
+            continue;
+        }
+
+        storage_segment_t *seg = segment_get(index, true);
+        if (seg == NULL)
+        {
+            return ERROR;
+        }
+        int ret = group_write_file(seg->fd, piece, count, seg_offset, piece_len);
+        segment_put(seg);
+        if (ret != 0)
+        {
+            return ERROR;
+        }
+        offset += piece_len;
+    }
+    return 0;
+}
+
+/* fdatasync the files holding [synced_end, committed_end) and publish the new durable end */
+static void storage_sync(void)
+{
+    off_t end = atomic_load_explicit(&committed_end, memory_order_acquire);
+    uint64_t started = stats_now();
+    int retval = 0;
+
+    if (synced_end >= end)
+    {
+        return;
+    }
+
+    if (config.segment_size == 0)
+    {
+        retval = fdatasync(storage_fd_shared);
+    }
+    else
+    {
+        unsigned long long last = (end - 1) / config.segment_size;
+        for (unsigned long long index = synced_end / config.segment_size; index <= last; index++)
+        {
+            /* A segment dropped by retention has nothing left to keep */
+            storage_segment_t *seg = segment_get(index, false);
+            if (seg != NULL)
+            {
+                if (fdatasync(seg->fd) != 0)
+                {
+                    retval = ERROR;
+                }
+                segment_put(seg);
+            }
+        }
+    }
+    if (retval != 0)
+    {
+        aesd_log(LOG_ERR, "storage: fdatasync failed: %s", strerror(errno));
+    }
+    stats_record(STATS_SYNC_LATENCY, stats_now() - started);
+
+    /* Strict waiters are released after a failed sync too, it is logged rather than retried */
+    pthread_mutex_lock(&commit_mutex);
+    synced_end = end;
+    pthread_cond_broadcast(&commit_done);
+    pthread_mutex_unlock(&commit_mutex);
+}
+
+/* Take every queued append and commit them in arrival order, STORAGE_GROUP_MAX at a time */
+static void group_commit_drain(void)
+{
+    storage_request_t *batch[STORAGE_GROUP_MAX];
+    struct iovec iov[STORAGE_GROUP_MAX];
+    storage_request_t *pending = NULL;
+    int limit = (config.durability == DURABILITY_PACKET) ? 1 : STORAGE_GROUP_MAX;
+    bool sync_batch = (config.durability == DURABILITY_BATCH) || (config.durability == DURABILITY_PACKET);
+    storage_request_t *req = atomic_exchange_explicit(&commit_queue, NULL, memory_order_acquire);
+
+    /* The stack is newest first, reverse it into arrival order */
+    while (req != NULL)
+    {
+        storage_request_t *older = req->next;
+        req->next = pending;
+        pending = req;
+        req = older;
+    }
+
+    while (pending != NULL)
+    {
+        off_t offset = atomic_load_explicit(&committed_end, memory_order_relaxed);
+        size_t total = 0;
+        int count = 0;
+
+        /* Read next before waking anyone, a woken request leaves with its stack frame */
+        for (; (pending != NULL) && (count < limit); pending = pending->next)
+        {
+            batch[count] = pending;
+            iov[count].iov_base = (void*)pending->buf;
+            iov[count].iov_len = pending->len;
+            total += pending->len;
+            count++;
+        }
+
+        /* Like a failed pwrite, a failed batch is committed anyway so offsets stay aligned */
+        int status = group_write(iov, count, offset, total);
+        if (status != 0)
+        {
+            atomic_store(&append_failed, true);
+        }
+        off_t packet_end = offset;
+        for (int i = 0; i < count; i++)
+        {
+            mirror_append(batch[i]->buf, batch[i]->len);
+            packet_end += batch[i]->len;
+            record_push(packet_end);
+        }
+        atomic_store_explicit(&reserved_end, offset + (off_t)total, memory_order_relaxed);
+        atomic_store_explicit(&committed_end, offset + (off_t)total, memory_order_release);
+        storage_retain(offset, total);
+        stats_record(STATS_COMMIT_BATCH, count);
+
+        /* Strict waiters are woken once, after the sync, the others before it */
+        if (sync_batch && config.sync_strict)
+        {
+            storage_sync();
+        }
+        pthread_mutex_lock(&commit_mutex);
+        for (int i = 0; i < count; i++)
+        {
+            offset += batch[i]->len;
+            batch[i]->end = offset;
+            batch[i]->status = status;
+            batch[i]->done = true;
+        }
+        pthread_cond_broadcast(&commit_done);
+        pthread_mutex_unlock(&commit_mutex);
+        if (sync_batch && !config.sync_strict)
+        {
+            storage_sync();
+        }
+    }
+}
+
+static void *threadfn_committer(void *unused)
+{
+    uint64_t interval = (uint64_t)STORAGE_SYNC_INTERVAL_MS * 1000000ULL;
+    uint64_t next_sync = stats_now() + interval;
+
+    pthread_mutex_lock(&commit_mutex);
+    while (1)
+    {
+        int ret = 0;
+        while (committer_running && (atomic_load(&commit_queue) == NULL) && (ret != ETIMEDOUT))
+        {
+            if (config.durability == DURABILITY_INTERVAL)
+            {
+                struct timespec deadline = { .tv_sec = next_sync / 1000000000ULL, .tv_nsec = next_sync % 1000000000ULL };
+                ret = pthread_cond_timedwait(&commit_wakeup, &commit_mutex, &deadline);
+            }
+            else
+            {
+                pthread_cond_wait(&commit_wakeup, &commit_mutex);
+            }
+        }
+        bool queued = (atomic_load(&commit_queue) != NULL);
+        if (!queued && !committer_running)
+        {
+            /* Stopping with nothing left to write */
+            break;
+        }
+        pthread_mutex_unlock(&commit_mutex);
+
+        if (queued)
+        {
+            group_commit_drain();
+        }
+        if ((config.durability == DURABILITY_INTERVAL) && (stats_now() >= next_sync))
+        {
+            storage_sync();
+            next_sync = stats_now() + interval;
+        }
+        pthread_mutex_lock(&commit_mutex);
+    }
+    pthread_mutex_unlock(&commit_mutex);
+
+    if (config.durability != DURABILITY_NONE)
+    {
+        storage_sync();
+    }
+    return NULL;
+}
+
+static int committer_start(void)
+{
+    pthread_condattr_t attr;
+
+    /* Interval deadlines are on the stats_now clock */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&commit_wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+
+    synced_end = atomic_load(&committed_end);
+    committer_running = true;
+    if (create_helper_thread(&committer_thread, threadfn_committer, NULL) != 0)
+    {
+        committer_running = false;
+        aesd_log(LOG_ERR, "storage: Committer thread creation failed");
+        return ERROR;
+    }
+    return 0;
+}
+
+static void committer_stop(void)
+{
+    pthread_mutex_lock(&commit_mutex);
+    if (!committer_running)
+    {
+        pthread_mutex_unlock(&commit_mutex);
+        return;
+    }
+    committer_running = false;
+    pthread_cond_signal(&commit_wakeup);
+    pthread_mutex_unlock(&commit_mutex);
+    pthread_join(committer_thread, NULL);
+    pthread_cond_destroy(&commit_wakeup);
+}
+
+/* Wait until the writers ahead of offset have committed, yielding at first and then asleep */
+static void commit_wait_turn(off_t offset)
+{
+    for (int spins = 0; spins < STORAGE_SPIN_LIMIT; spins++)
+    {
+        if (atomic_load_explicit(&committed_end, memory_order_acquire) == offset)
+        {
+            return;
+        }
+        sched_yield();
+    }
+
+    /* Counted before the check under turn_mutex, so a commit either is seen or wakes us */
+    atomic_fetch_add(&turn_sleepers, 1);
+    pthread_mutex_lock(&turn_mutex);
+    while (atomic_load(&committed_end) != offset)
+    {
+        pthread_cond_wait(&commit_turn, &turn_mutex);
+    }
+    pthread_mutex_unlock(&turn_mutex);
+    atomic_fetch_sub(&turn_sleepers, 1);
+}
+
+/* Commit up to end and wake any writer that went to sleep waiting for it */
+static void commit_pass_turn(off_t end)
+{
+    atomic_store(&committed_end, end);
+    if (atomic_load(&turn_sleepers) > 0)
+    {
+        pthread_mutex_lock(&turn_mutex);
+        pthread_cond_broadcast(&commit_turn);
+        pthread_mutex_unlock(&turn_mutex);
+    }
+}
+
+/* Queue an append for the committer and sleep until its batch is committed, or synced if strict */
+static int group_append(const char *buf, size_t len, off_t *end)
+{
+    storage_request_t req = { .buf = buf, .len = len, .end = 0, .status = 0, .done = false };
+    uint64_t wait_start = stats_now();
+
+    req.next = atomic_load_explicit(&commit_queue, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&commit_queue, &req.next, &req,
+                                                  memory_order_release, memory_order_relaxed))
+    {
+    }
+
+    pthread_mutex_lock(&commit_mutex);
+    if (req.next == NULL)
+    {
+        /* The queue was empty, the committer may be asleep */
+        pthread_cond_signal(&commit_wakeup);
+    }
+    while (!req.done || (config.sync_strict && (synced_end < req.end)))
+    {
+        pthread_cond_wait(&commit_done, &commit_mutex);
+    }
+    pthread_mutex_unlock(&commit_mutex);
+    stats_record(STATS_LOCK_WAIT, stats_now() - wait_start);
+
+    *end = req.end;
+    return req.status;
+}
+#endif
+
+int storage_init(void)
+{
+#if (USE_AESD_CHAR_DEVICE == 0)
+    if (config.segment_size > 0)
+    {
+        /* Segments are opened as the log reaches them, the log starts empty */
+        return config.group_commit ? committer_start() : 0;
+    }
+#endif
+
+    storage_fd_shared = storage_open();
+    if (storage_fd_shared == ERROR)
+    {
+        return ERROR;
+    }
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+    struct stat file_stat;
+    if (fstat(storage_fd_shared, &file_stat) != 0)
+    {
+        aesd_log(LOG_ERR, "storage: fstat failed: %s", strerror(errno));
+        close(storage_fd_shared);
+        storage_fd_shared = -1;
+        return ERROR;
+    }
+
+    atomic_store(&reserved_end, file_stat.st_size);
+    atomic_store(&committed_end, file_stat.st_size);
+    if (file_stat.st_size > 0)
+    {
+        records_load(storage_fd_shared, file_stat.st_size);
+    }
+
+    if (config.group_commit && (committer_start() != 0))
+    {
+        close(storage_fd_shared);
+        storage_fd_shared = -1;
+        return ERROR;
+    }
+#endif
+    return 0;
+}
+
+void storage_destroy(void)
+{
+#if (USE_AESD_CHAR_DEVICE == 0)
+    /* Every appender has returned, the queue is empty */
+    committer_stop();
+#endif
+    if (storage_fd_shared != -1)
+    {
+        close(storage_fd_shared);
+        storage_fd_shared = -1;
+    }
+#if (USE_AESD_CHAR_DEVICE == 0)
+    /* Segment files go at exit like FILE_NAME does */
+    pthread_mutex_lock(&segments_mutex);
+    while (first_segment < next_segment)
+    {
+        segment_drop_oldest_locked();
+    }
+    first_segment = 0;
+    next_segment = 0;
+    pthread_mutex_unlock(&segments_mutex);
+
+    storage_map_t *map = atomic_exchange(&file_map, NULL);
+    while (map != NULL)
+    {
+        storage_map_t *prev = map->prev;
+        munmap(map->base, map->size);
+        free(map);
+        map = prev;
+    }
+
+    atomic_store(&log_start, 0);
+    pthread_mutex_lock(&records_mutex);
+    free(record_ends);
+    record_ends = NULL;
+    records_head = 0;
+    records_count = 0;
+    records_capacity = 0;
+    records_start = 0;
+    records_lost = false;
+    pthread_mutex_unlock(&records_mutex);
+    atomic_store(&oldest_expiry, LLONG_MAX);
+    atomic_store(&reserved_end, 0);
+    atomic_store(&committed_end, 0);
+    atomic_store(&append_failed, false);
+#endif
+}
+
+int storage_fd(void)
+{
+    return storage_fd_shared;
+}
+
+int storage_append(const char *buf, size_t len, off_t *end)
+{
+    int retval = 0;
+    int fd = storage_fd_shared;
+    uint64_t started = stats_now();
+    uint64_t wait_start;
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+    if (config.group_commit)
+    {
+        retval = group_append(buf, len, end);
+        stats_record(STATS_APPEND_LATENCY, stats_now() - started);
+        return retval;
+    }
+
+    off_t offset = atomic_fetch_add(&reserved_end, (long long)len);
+    size_t written = 0;
+
+    if (config.segment_size > 0)
+    {
+        retval = segment_write(buf, len, offset);
+    }
+    while ((config.segment_size == 0) && (written < len))
+    {
+        ssize_t ret = pwrite(fd, buf + written, len - written, offset + written);
+        if (ret == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            /* The range stays reserved, committing it keeps later writers moving */
+            aesd_log(LOG_ERR, "storage: pwrite failed: %s", strerror(errno));
+            retval = ERROR;
+            break;
+        }
+        written += ret;
+    }
+
+    if (retval != 0)
+    {
+        atomic_store(&append_failed, true);
+    }
+
+    wait_start = stats_now();
+    commit_wait_turn(offset);
+    stats_record(STATS_LOCK_WAIT, stats_now() - wait_start);
+    /* Mirror and index the intended bytes even after a failed write so offsets stay aligned */
+    mirror_append(buf, len);
+    record_push(offset + (off_t)len);
+    commit_pass_turn(offset + (off_t)len);
+
+    /* Limits are applied again once an append that crossed into new segments is committed,
+       and age retention also applies between segment switches */
+    storage_retain(offset, len);
+
+    *end = offset + (off_t)len;
+#else
+    wait_start = stats_now();
+    pthread_mutex_lock(&device_write_mutex);
+    stats_record(STATS_LOCK_WAIT, stats_now() - wait_start);
+    ssize_t ret = write(fd, buf, len);
+    pthread_mutex_unlock(&device_write_mutex);
+
+    if ((ret == ERROR) || ((size_t)ret != len))
+    {
+        aesd_log(LOG_ERR, "storage: Write to %s failed", FILE_NAME);
+        retval = ERROR;
+    }
+    *end = -1;
+#endif
+
+    stats_record(STATS_APPEND_LATENCY, stats_now() - started);
+    return retval;
+}
+
+off_t storage_end(void)
+{
+#if (USE_AESD_CHAR_DEVICE == 0)
+    return atomic_load_explicit(&committed_end, memory_order_acquire);
+#else
+    return -1;
+#endif
+}
+
+off_t storage_start(void)
+{
+#if (USE_AESD_CHAR_DEVICE == 0)
+    return atomic_load(&log_start);
+#else
+    return 0;
+#endif
+}
+
+replay_status_t storage_replay_spans(off_t *offset, off_t end, storage_span_fn fn, void *arg)
+{
+#if (USE_AESD_CHAR_DEVICE == 0)
+    if (config.segment_size > 0)
+    {
+        bool from_oldest = (*offset == 0);
+
+        if (end < 0)
+        {
+            end = storage_end();
+        }
+        while (*offset < end)
+        {
+            storage_segment_t *seg = from_oldest ? segment_get_oldest(offset) : segment_get(*offset / config.segment_size, false);
+            from_oldest = false;
+            if (*offset >= end)
+            {
+                /* Retention dropped everything below end */
+                if (seg != NULL)
+                {
+                    segment_put(seg);
+                }
+                break;
+            }
+
+            unsigned long long index = *offset / config.segment_size;
+            off_t base = (off_t)(index * config.segment_size);
+            off_t seg_end = ((end - base) < config.segment_size) ? (end - base) : config.segment_size;
+            off_t seg_offset = *offset - base;
+
+            if ((seg == NULL) || (seg->index != index))
+            {
+                if (seg != NULL)
+                {
+                    segment_put(seg);
+                }
+                aesd_log(LOG_ERR, "storage: Replay range dropped by retention");
+                return REPLAY_ERROR;
+            }
+            replay_status_t status = fn(arg, seg->fd, atomic_load(&append_failed) ? NULL : seg->map, &seg_offset, seg_end);
+            segment_put(seg);
+
+            if ((status == REPLAY_DONE) && (base + seg_offset == *offset))
+            {
+                /* Segment shorter than the committed log, a failed append left a hole */
+                aesd_log(LOG_ERR, "storage: Segment %llu is truncated", index);
+                return REPLAY_ERROR;
+            }
+            *offset = base + seg_offset;
+            if (status != REPLAY_DONE)
+            {
+                return status;
+            }
+        }
+        return REPLAY_DONE;
+    }
+
+    /* A mapping faults past the end of its file, a descriptor just stops there */
+    if (config.use_mmap && (end >= 0) && !atomic_load(&append_failed))
+    {
+        return fn(arg, storage_fd_shared, storage_map_covering(end), offset, end);
+    }
+#endif
+
+    return fn(arg, storage_fd_shared, NULL, offset, end);
+}
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+int storage_resume(off_t offset, off_t *start, off_t *end)
+{
+    if (offset < 0)
+    {
+        return ERROR;
+    }
+
+    *end = storage_end();
+    *start = (offset > *end) ? *end : offset;
+    if (*start < storage_start())
+    {
+        /* Replays from 0 begin at the oldest packet in one step with retention */
+        *start = 0;
+    }
+    return 0;
+}
+
+int storage_locate(unsigned int write_cmd, unsigned int write_cmd_offset, off_t end, off_t *offset)
+{
+    off_t packet_start;
+    off_t packet_end;
+
+    if ((record_find(write_cmd, end, &packet_start, &packet_end) != 0) ||
+        ((off_t)write_cmd_offset >= packet_end - packet_start))
+    {
+        return ERROR;
+    }
+    *offset = packet_start + write_cmd_offset;
+    return 0;
+}
+#endif
+
+#if (USE_AESD_CHAR_DEVICE == 1)
+int storage_seek(unsigned int write_cmd, unsigned int write_cmd_offset, off_t *offset)
+{
+    struct aesd_seekto seekto = { .write_cmd = write_cmd, .write_cmd_offset = write_cmd_offset };
+    int retval = ERROR;
+
+    /* The driver resolves the position into f_pos, keep that off the shared descriptor */
+    int fd = storage_open();
+    if (fd == ERROR)
+    {
+        return ERROR;
+    }
+
+    if (ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto) != 0)
+    {
+        aesd_log(LOG_ERR, "storage: ioctl failed: %s", strerror(errno));
+        goto seek_exit;
+    }
+    *offset = lseek(fd, 0, SEEK_CUR);
+    if (*offset == ERROR)
+    {
+        aesd_log(LOG_ERR, "storage: Failed to get file position: %s", strerror(errno));
+        goto seek_exit;
+    }
+    retval = 0;
+
+seek_exit:
+    close(fd);
+    return retval;
+}
+#endif
+
+typedef struct storage_gather_buf
+{
+    char *buf;
+    size_t size;
+    size_t filled;
+} storage_gather_buf_t;
+
+/* Span callback of storage_gather, REPLAY_AGAIN once the buffer is full */
+static replay_status_t gather_span(void *arg, int fd, const char *file_map, off_t *offset, off_t end)
+{
+    storage_gather_buf_t *gather = (storage_gather_buf_t*)arg;
+
+    while (gather->filled < gather->size)
+    {
+        size_t want = gather->size - gather->filled;
+        if ((end >= 0) && ((off_t)want > end - *offset))
+        {
+            want = end - *offset;
+        }
+        if (want == 0)
+        {
+            break;
+        }
+
+        ssize_t read_bytes = pread(fd, gather->buf + gather->filled, want, *offset);
+        if (read_bytes == 0)
+        {
+            break;
+        }
+        if (read_bytes == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            aesd_log(LOG_ERR, "storage: pread failed: %s", strerror(errno));
+            return REPLAY_ERROR;
+        }
+        gather->filled += read_bytes;
+        *offset += read_bytes;
+    }
+
+    return (gather->filled == gather->size) ? REPLAY_AGAIN : REPLAY_DONE;
+}
+
+ssize_t storage_gather(char *buf, size_t buf_size, off_t *offset, off_t end)
+{
+    storage_gather_buf_t gather = { .buf = buf, .size = buf_size, .filled = 0 };
+
+    if (storage_replay_spans(offset, end, gather_span, &gather) == REPLAY_ERROR)
+    {
+        return ERROR;
+    }
+    return gather.filled;
+}
+
+replay_status_t storage_replay_copy(int client_fd, off_t *offset, off_t end, char *buf, size_t buf_size)
+{
+    while (1)
+    {
+        ssize_t read_bytes = storage_gather(buf, buf_size, offset, end);
+        if (read_bytes == 0)
+        {
+            break;
+        }
+        if (read_bytes == ERROR)
+        {
+            return REPLAY_ERROR;
+        }
+
+        /* Tell TCP more is coming so it keeps building full segments */
+        int flags = MSG_NOSIGNAL | (((end >= 0) && (*offset < end)) ? MSG_MORE : 0);
+        ssize_t sent = 0;
+        while (sent < read_bytes)
+        {
+            ssize_t ret = send(client_fd, buf + sent, read_bytes - sent, flags);
+            if (ret == ERROR)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                aesd_log(LOG_ERR, "storage: Send to client failed: %s", strerror(errno));
+                return REPLAY_ERROR;
+            }
+            sent += ret;
+        }
+    }
+
+    return REPLAY_DONE;
+}
@@ -0,0 +1,147 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-storage.h
+ * @brief   Ordered appends and lock-free replays of the aesdsocket data log
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_STORAGE_H
+#define AESD_STORAGE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "aesdsocket.h"
+#include "aesd-replay.h"
+
+#define STORAGE_MAX_SEGMENTS (4096)         /* Segment files kept at most */
+#define STORAGE_MIN_SEGMENT (4096)          /* Smallest segment size in bytes */
+#define STORAGE_LOCATE_CHUNK (4096)         /* Bytes scanned per read when indexing a leftover log */
+#define STORAGE_RECORDS_INITIAL (1024)      /* First size of the record index, doubled as it fills */
+#define STORAGE_MAP_INITIAL (1024 * 1024)   /* First mapping of FILE_NAME, doubled as the log grows */
+#define STORAGE_GROUP_MAX (1024)            /* Appends per group commit pwritev, at most IOV_MAX */
+#define STORAGE_SYNC_INTERVAL_MS (100)      /* Between syncs with DURABILITY_INTERVAL */
+#define STORAGE_SPIN_LIMIT (64)             /* Yields waiting for the writers ahead before sleeping */
+
+/**
+ * Open the descriptor on FILE_NAME shared by all workers and pick up its
+ * current size as the starting end of the log. Starts the committer thread
+ * with config.group_commit.
+ * @return 0 on success, ERROR on failure
+ */
+int storage_init(void);
+
+/**
+ * Stop the committer after a last sync under config.durability, close the
+ * shared descriptor and release the storage state. No append may be in
+ * progress.
+ */
+void storage_destroy(void);
+
+/**
+ * @return the shared descriptor on FILE_NAME. Use positional I/O only, its
+ * file position belongs to nobody.
+ */
+int storage_fd(void);
+
+/**
+ * Append buf to the log. In file mode every writer reserves its own offset and
+ * writes in parallel with pwrite, then publishes the new end in reservation
+ * order, so the log never shows a gap to readers. With config.group_commit
+ * the committer thread writes it instead, batched with the appends queued
+ * alongside it, and this returns once that batch is committed, or once a
+ * sync covers it with config.sync_strict. The char device orders writes
+ * itself and only needs its writes serialised.
+ * @param end set to the end of the log including this append (file mode), or
+ *            -1 when the reader should replay up to end of file (char device)
+ * @return 0 on success, ERROR on failure
+ */
+int storage_append(const char *buf, size_t len, off_t *end);
+
+/**
+ * @return the published end of the log, every byte below it is written
+ */
+off_t storage_end(void);
+
+/**
+ * @return the first packet of the log still kept, 0 unless retention dropped
+ * segments
+ */
+off_t storage_start(void);
+
+/**
+ * Replay step over one file: send from *offset up to end (-1 for end of file)
+ * of file_fd, advancing *offset. file_map is the file's read-only mapping with
+ * config.use_mmap, NULL otherwise.
+ */
+typedef replay_status_t (*storage_span_fn)(void *arg, int file_fd, const char *file_map, off_t *offset, off_t end);
+
+/**
+ * Walk [*offset, end) of the log one segment at a time, calling fn with that
+ * segment's descriptor and file offsets. Without segments it is one call on
+ * the shared descriptor. A replay from offset 0 starts at the first packet
+ * retention kept. A segment stays open while fn runs, even if
+ * retention drops it meanwhile.
+ * @param offset log position, advanced by what fn consumed
+ * @return REPLAY_DONE, the first other status fn returned, or REPLAY_ERROR if
+ * part of the range was already dropped
+ */
+replay_status_t storage_replay_spans(off_t *offset, off_t end, storage_span_fn fn, void *arg);
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+/**
+ * Resolve a resume command: the log from offset up to the current end, or from
+ * the oldest packet kept if retention dropped offset. Offsets past the end
+ * give an empty range.
+ * @param start set to the replay start, 0 meaning the oldest packet kept
+ * @param end set to the replay end, the cursor the client resumes from next
+ * @return 0 on success, ERROR for a negative offset
+ */
+int storage_resume(off_t offset, off_t *start, off_t *end);
+
+/**
+ * File backend counterpart of AESDCHAR_IOCSEEKTO: find byte write_cmd_offset
+ * of packet write_cmd, counted from the oldest packet kept like the driver
+ * counts from its oldest entry. Looks the packet up in the record index,
+ * only packets that end below end count.
+ * @return 0 with offset set, ERROR if the position is past the log
+ */
+int storage_locate(unsigned int write_cmd, unsigned int write_cmd_offset, off_t end, off_t *offset);
+#endif
+
+#if (USE_AESD_CHAR_DEVICE == 1)
+/**
+ * Apply an AESDCHAR_IOCSEEKTO command and report the resulting position for a
+ * positional replay from the shared descriptor.
+ * @return 0 on success, ERROR on failure
+ */
+int storage_seek(unsigned int write_cmd, unsigned int write_cmd_offset, off_t *offset);
+#endif
+
+/**
+ * Fill buf from [*offset, end) of the log with as many preads as it takes. The
+ * char device returns one write command per read, gathering them here keeps
+ * each send full sized.
+ * @param offset start position, advanced by the bytes read
+ * @return the bytes read, 0 at the end of the log, ERROR on failure
+ */
+ssize_t storage_gather(char *buf, size_t buf_size, off_t *offset, off_t end);
+
+/**
+ * Copy [*offset, end) of the log to client_fd through buf, one send per full
+ * buffer, holding no lock. end of -1 means up to end of file.
+ * @param offset start position, advanced by the number of bytes sent
+ */
+replay_status_t storage_replay_copy(int client_fd, off_t *offset, off_t end, char *buf, size_t buf_size);
+
+#endif /* AESD_STORAGE_H */
@@ -0,0 +1,107 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-timer.c
+ * @brief   Hashed timer wheel for connection deadlines
+ *
+ * Every connection has an idle or write stall deadline. A deadline moves
+ * whenever the connection makes progress, so they are set far more often
+ * than they fire. A timerfd each would cost syscalls per update and a sorted
+ * structure would cost log n. The wheel hashes a deadline into slot
+ * tick % TIMER_SLOTS, so arming and cancelling are list operations. The owner
+ * advances the wheel from its poll loop every TIMER_TICK_MS. Each tick visits
+ * one slot and fires only the entries that are due. Deadlines more than one
+ * turn away stay in their slot until their turn comes.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ * @references
+ * 1. G. Varghese and T. Lauck, "Hashed and Hierarchical Timing Wheels", SOSP 1987
+ */
+
+#include "aesd-timer.h"
+
+#define TIMER_TICK_NS ((uint64_t)TIMER_TICK_MS * 1000000ULL)
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now)
+{
+    wheel->tick = now / TIMER_TICK_NS;
+    wheel->armed = 0;
+    for (int i = 0; i < TIMER_SLOTS; i++)
+    {
+        LIST_INIT(&wheel->slots[i]);
+    }
+}
+
+void timer_arm(timer_wheel_t *wheel, timer_entry_t *entry, uint64_t now, unsigned int timeout_ms)
+{
+    uint64_t ticks = (timeout_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+
+    timer_cancel(wheel, entry);
+
+    /* Never behind the wheel, an entry lands in a slot still to be visited */
+    uint64_t from = now / TIMER_TICK_NS;
+    if (from < wheel->tick)
+    {
+        from = wheel->tick;
+    }
+    entry->expires = from + ((ticks > 0) ? ticks : 1);
+    entry->armed = true;
+    LIST_INSERT_HEAD(&wheel->slots[entry->expires % TIMER_SLOTS], entry, link);
+    wheel->armed++;
+}
+
+void timer_cancel(timer_wheel_t *wheel, timer_entry_t *entry)
+{
+    if (entry->armed)
+    {
+        LIST_REMOVE(entry, link);
+        entry->armed = false;
+        wheel->armed--;
+    }
+}
+
+void timer_advance(timer_wheel_t *wheel, uint64_t now, timer_fn fn, void *arg)
+{
+    uint64_t target = now / TIMER_TICK_NS;
+    uint64_t steps = target - wheel->tick;
+    timer_entry_t *entry;
+    timer_entry_t *tmp;
+
+    if (target <= wheel->tick)
+    {
+        return;
+    }
+    /* After a long gap one turn visits every slot */
+    if (steps > TIMER_SLOTS)
+    {
+        steps = TIMER_SLOTS;
+    }
+
+    for (uint64_t step = 1; step <= steps; step++)
+    {
+        struct timer_slot *slot = &wheel->slots[(wheel->tick + step) % TIMER_SLOTS];
+        LIST_FOREACH_SAFE(entry, slot, link, tmp)
+        {
+            if (entry->expires <= target)
+            {
+                timer_cancel(wheel, entry);
+                fn(entry, arg);
+            }
+        }
+    }
+    wheel->tick = target;
+}
+
+int timer_poll_timeout(const timer_wheel_t *wheel)
+{
+    return (wheel->armed > 0) ? TIMER_TICK_MS : -1;
+}
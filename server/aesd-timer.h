@@ -0,0 +1,76 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-timer.h
+ * @brief   Hashed timer wheel for connection deadlines
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_TIMER_H
+#define AESD_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "queue.h"
+
+#define TIMER_TICK_MS (100)         /* Deadline resolution */
+#define TIMER_SLOTS (1024)          /* Ticks per turn of the wheel, later deadlines wait for their turn */
+
+/* One deadline, embedded in what it times out */
+typedef struct timer_entry
+{
+    uint64_t expires;               /* Tick it fires at */
+    bool armed;
+    void *data;                     /* Owner, set by the caller */
+    LIST_ENTRY(timer_entry) link;
+} timer_entry_t;
+
+/* Not locked, each wheel belongs to one thread or is guarded by its owner */
+typedef struct timer_wheel
+{
+    uint64_t tick;                  /* Last tick advanced to */
+    size_t armed;                   /* Entries in the slots */
+    LIST_HEAD(timer_slot, timer_entry) slots[TIMER_SLOTS];
+} timer_wheel_t;
+
+typedef void (*timer_fn)(timer_entry_t *entry, void *arg);
+
+/**
+ * Start an empty wheel at now (stats_now() ns).
+ */
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now);
+
+/**
+ * Set the deadline of entry to timeout_ms after now, replacing any it had.
+ * O(1), no syscall.
+ */
+void timer_arm(timer_wheel_t *wheel, timer_entry_t *entry, uint64_t now, unsigned int timeout_ms);
+
+/**
+ * Remove the deadline of entry, if armed.
+ */
+void timer_cancel(timer_wheel_t *wheel, timer_entry_t *entry);
+
+/**
+ * Fire every entry whose deadline passed by now. Each is disarmed before fn
+ * is called, so fn may free it or arm it again.
+ */
+void timer_advance(timer_wheel_t *wheel, uint64_t now, timer_fn fn, void *arg);
+
+/**
+ * @return the poll timeout until the next tick in ms, -1 if nothing is armed
+ */
+int timer_poll_timeout(const timer_wheel_t *wheel);
+
+#endif /* AESD_TIMER_H */
@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-timestamp.c
+ * @brief   timerfd driven timestamp records for the aesdsocket data log
+ *
+ * Timestamps used to come from a dedicated thread sleeping in
+ * clock_nanosleep() and killed with pthread_cancel at exit. Now a timerfd
+ * sits in the accept loop (thread and pool modes) or in the first event loop
+ * (epoll mode), and the record goes through storage_append like any packet.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ * @references
+ * 1. https://man7.org/linux/man-pages/man2/timerfd_create.2.html
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-timestamp.h"
+#include "aesd-storage.h"
+
+int timestamp_timer_create(void)
+{
+#if (USE_AESD_CHAR_DEVICE == 0)
+    if (config.timestamp_interval <= 0)
+    {
+        return -1;
+    }
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == ERROR)
+    {
+        aesd_log(LOG_ERR, "timestamp: timerfd_create failed: %s", strerror(errno));
+        return -1;
+    }
+
+    struct itimerspec period = {
+        .it_interval = { .tv_sec = config.timestamp_interval, .tv_nsec = 0 },
+        .it_value = { .tv_sec = config.timestamp_interval, .tv_nsec = 0 },
+    };
+    if (timerfd_settime(timer_fd, 0, &period, NULL) != 0)
+    {
+        aesd_log(LOG_ERR, "timestamp: timerfd_settime failed: %s", strerror(errno));
+        close(timer_fd);
+        return -1;
+    }
+    return timer_fd;
+#else
+    /* The driver keeps only client writes */
+    return -1;
+#endif
+}
+
+void timestamp_timer_fire(int timer_fd)
+{
+    uint64_t expirations;
+    char outstr[300];
+    struct tm tm_now;
+    time_t now;
+    off_t log_end;
+
+    /* Missed periods collapse into one record */
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return;
+    }
+
+    now = time(NULL);
+    if (localtime_r(&now, &tm_now) == NULL)
+    {
+        aesd_log(LOG_ERR, "timestamp: localtime failed");
+        return;
+    }
+
+    if (strftime(outstr, sizeof(outstr), "timestamp: %Y/%m/%d %H:%M:%S\n", &tm_now) == 0)
+    {
+        aesd_log(LOG_ERR, "timestamp: strftime failed");
+        return;
+    }
+
+    if (storage_append(outstr, strlen(outstr), &log_end) != 0)
+    {
+        aesd_log(LOG_ERR, "timestamp: Timestamp write failed");
+    }
+}
@@ -0,0 +1,37 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-timestamp.h
+ * @brief   timerfd driven timestamp records for the aesdsocket data log
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_TIMESTAMP_H
+#define AESD_TIMESTAMP_H
+
+#define TIMESTAMP_INTERVAL (10)     /* Default seconds between timestamps */
+
+/**
+ * Create a non-blocking periodic timerfd firing every config.timestamp_interval
+ * seconds, for the caller's event loop to wait on.
+ * @return the timer fd, or -1 when timestamps are disabled or failed
+ */
+int timestamp_timer_create(void);
+
+/**
+ * Called when the timer fd is readable: drain the expirations and append one
+ * "timestamp: %Y/%m/%d %H:%M:%S" record to the log.
+ */
+void timestamp_timer_fire(int timer_fd);
+
+#endif /* AESD_TIMESTAMP_H */
@@ -0,0 +1,484 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-uring.c
+ * @brief   io_uring I/O engine for aesdsocket
+ *
+ * A small raw io_uring wrapper (no liburing dependency). Each connection
+ * handling thread gets its own ring. A replay reads FILE_NAME in
+ * URING_REPLAY_BATCH chunks per submission and sends them as a linked chain
+ * together with the reads of the next batch, so a replay costs one
+ * io_uring_enter per batch instead of a read and a send syscall per chunk.
+ *
+ * Appends stay on a synchronous pwrite in aesd-storage.c. A writer has to
+ * know its bytes are written before it can commit them in log order, so a
+ * ring submission would be waited on at once and save nothing over the
+ * syscall. A pwrite into the page cache rarely blocks, and group commit
+ * already batches appends into one pwritev under load.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ * @references
+ * 1. https://man7.org/linux/man-pages/man7/io_uring.7.html
+ * 2. https://man7.org/linux/man-pages/man2/io_uring_enter.2.html
+ * 3. https://kernel.dk/io_uring.pdf
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-uring.h"
+
+/* user_data layout: kind in the top byte, buffer index in the low bits */
+#define URING_KIND_READ  (2ULL << 56)
+#define URING_KIND_SEND  (3ULL << 56)
+#define URING_KIND_MASK  (0xFFULL << 56)
+#define URING_NUM_BUFS   (2 * URING_REPLAY_BATCH)
+
+struct aesd_uring
+{
+    int ring_fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_entries;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *ring_ptr;
+    size_t ring_len;
+    size_t sqes_len;
+    char *bufs;                         /* URING_NUM_BUFS replay chunks, double buffered */
+};
+
+/* One replay chunk in flight */
+typedef struct uring_chunk
+{
+    off_t offset;
+    size_t len;
+    ssize_t res;
+} uring_chunk_t;
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void uring_destroy(void *ring_struct)
+{
+    aesd_uring_t *ring = (aesd_uring_t*)ring_struct;
+
+    if (ring == NULL)
+    {
+        return;
+    }
+    if (ring->sqes != NULL)
+    {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->ring_ptr != NULL)
+    {
+        munmap(ring->ring_ptr, ring->ring_len);
+    }
+    if (ring->ring_fd != -1)
+    {
+        close(ring->ring_fd);
+    }
+    free(ring->bufs);
+    free(ring);
+}
+
+static aesd_uring_t *uring_create(unsigned entries)
+{
+    struct io_uring_params params;
+    aesd_uring_t *ring = calloc(1, sizeof(aesd_uring_t));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+
+    memset(&params, 0, sizeof(params));
+    ring->ring_fd = sys_io_uring_setup(entries, &params);
+    if (ring->ring_fd == ERROR)
+    {
+        aesd_log(LOG_ERR, "uring: io_uring_setup failed: %s", strerror(errno));
+        goto uring_create_fail;
+    }
+
+    /* Only the single mmap layout (5.4+) is supported */
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+    {
+        aesd_log(LOG_ERR, "uring: Kernel io_uring is too old");
+        goto uring_create_fail;
+    }
+
+    size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_len = (sq_len > cq_len) ? sq_len : cq_len;
+    ring->ring_ptr = mmap(NULL, ring->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->ring_ptr == MAP_FAILED)
+    {
+        ring->ring_ptr = NULL;
+        aesd_log(LOG_ERR, "uring: Ring mmap failed: %s", strerror(errno));
+        goto uring_create_fail;
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        aesd_log(LOG_ERR, "uring: SQE mmap failed: %s", strerror(errno));
+        goto uring_create_fail;
+    }
+
+    char *base = (char*)ring->ring_ptr;
+    ring->sq_head = (unsigned*)(base + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(base + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(base + params.sq_off.ring_mask);
+    ring->sq_entries = (unsigned*)(base + params.sq_off.ring_entries);
+    ring->sq_array = (unsigned*)(base + params.sq_off.array);
+    ring->cq_head = (unsigned*)(base + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(base + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(base + params.cq_off.cqes);
+
+    ring->bufs = malloc(URING_NUM_BUFS * URING_REPLAY_CHUNK);
+    if (ring->bufs == NULL)
+    {
+        aesd_log(LOG_ERR, "uring: Malloc for replay buffers failed");
+        goto uring_create_fail;
+    }
+
+    return ring;
+
+uring_create_fail:
+    uring_destroy(ring);
+    return NULL;
+}
+
+static struct io_uring_sqe *uring_get_sqe(aesd_uring_t *ring)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= *ring->sq_entries)
+    {
+        return NULL;
+    }
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+static void uring_prep(struct io_uring_sqe *sqe, int opcode, int fd, const void *addr, size_t len, off_t offset, uint64_t user_data)
+{
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+}
+
+/* Submit everything queued and collect exactly count completions into cqes */
+static int uring_submit_and_wait(aesd_uring_t *ring, struct io_uring_cqe *cqes, unsigned count)
+{
+    unsigned reaped = 0;
+
+    while (reaped < count)
+    {
+        unsigned to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (sys_io_uring_enter(ring->ring_fd, to_submit, count - reaped, IORING_ENTER_GETEVENTS) == ERROR)
+        {
+            if ((errno == EINTR) || (errno == EAGAIN))
+            {
+                continue;
+            }
+            aesd_log(LOG_ERR, "uring: io_uring_enter failed: %s", strerror(errno));
+            return ERROR;
+        }
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while ((head != tail) && (reaped < count))
+        {
+            cqes[reaped++] = ring->cqes[head & *ring->cq_mask];
+            head++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+static void ring_key_create(void)
+{
+    pthread_key_create(&ring_key, uring_destroy);
+}
+
+bool uring_probe(void)
+{
+    bool supported = false;
+    aesd_uring_t *ring = uring_create(2);
+    if (ring == NULL)
+    {
+        return false;
+    }
+
+    size_t probe_len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_len);
+    if (probe == NULL)
+    {
+        goto uring_probe_exit;
+    }
+
+    if (syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_PROBE, probe, 256) == ERROR)
+    {
+        aesd_log(LOG_ERR, "uring: Probe failed: %s", strerror(errno));
+        goto uring_probe_exit;
+    }
+
+    /* Only receives and replays go through the ring, appends stay synchronous (see above) */
+    const int needed_ops[] = { IORING_OP_RECV, IORING_OP_SEND, IORING_OP_READ };
+    supported = true;
+    for (size_t i = 0; i < sizeof(needed_ops) / sizeof(needed_ops[0]); i++)
+    {
+        if ((needed_ops[i] > probe->last_op) || !(probe->ops[needed_ops[i]].flags & IO_URING_OP_SUPPORTED))
+        {
+            supported = false;
+        }
+    }
+
+uring_probe_exit:
+    free(probe);
+    uring_destroy(ring);
+    return supported;
+}
+
+aesd_uring_t *uring_thread_ring(void)
+{
+    if (!config.use_uring)
+    {
+        return NULL;
+    }
+
+    pthread_once(&ring_key_once, ring_key_create);
+    aesd_uring_t *ring = pthread_getspecific(ring_key);
+    if (ring == NULL)
+    {
+        ring = uring_create(URING_QUEUE_DEPTH);
+        if (ring != NULL)
+        {
+            pthread_setspecific(ring_key, ring);
+        }
+    }
+
+    return ring;
+}
+
+ssize_t uring_recv(aesd_uring_t *ring, int fd, void *buf, size_t len)
+{
+    struct io_uring_cqe cqe;
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (sqe == NULL)
+    {
+        errno = EBUSY;
+        return ERROR;
+    }
+
+    uring_prep(sqe, IORING_OP_RECV, fd, buf, len, 0, 0);
+    if (uring_submit_and_wait(ring, &cqe, 1) != 0)
+    {
+        return ERROR;
+    }
+    if (cqe.res < 0)
+    {
+        errno = -cqe.res;
+        return ERROR;
+    }
+
+    return cqe.res;
+}
+
+static int send_all(int client_fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t sent = send(client_fd, buf, len, MSG_NOSIGNAL);
+        if (sent == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return ERROR;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+/* Queue reads for up to URING_REPLAY_BATCH chunks of [offset, end) into buffer set */
+static unsigned queue_reads(aesd_uring_t *ring, uring_chunk_t *chunks, int set, int file_fd, off_t offset, off_t end)
+{
+    unsigned n;
+
+    for (n = 0; (n < URING_REPLAY_BATCH) && (offset < end); n++)
+    {
+        size_t len = ((end - offset) > URING_REPLAY_CHUNK) ? URING_REPLAY_CHUNK : (size_t)(end - offset);
+        struct io_uring_sqe *sqe = uring_get_sqe(ring);
+        char *chunk_buf = ring->bufs + (set * URING_REPLAY_BATCH + n) * URING_REPLAY_CHUNK;
+
+        chunks[n].offset = offset;
+        chunks[n].len = len;
+        chunks[n].res = -ECANCELED;
+        uring_prep(sqe, IORING_OP_READ, file_fd, chunk_buf, len, offset, URING_KIND_READ | n);
+        offset += len;
+    }
+
+    return n;
+}
+
+int uring_replay(aesd_uring_t *ring, int file_fd, int client_fd, off_t offset, off_t end)
+{
+    struct io_uring_cqe cqes[URING_QUEUE_DEPTH];
+    uring_chunk_t chunks[2][URING_REPLAY_BATCH];
+    struct io_uring_sqe *sqe;
+    unsigned num_reads[2] = { 0, 0 };
+    unsigned num_sends = 0;
+    int set = 0;
+
+    num_reads[set] = queue_reads(ring, chunks[set], set, file_fd, offset, end);
+    if (num_reads[set] > 0)
+    {
+        offset = chunks[set][num_reads[set] - 1].offset + chunks[set][num_reads[set] - 1].len;
+    }
+
+    unsigned expected = num_reads[set];
+
+    while (expected > 0)
+    {
+        if (uring_submit_and_wait(ring, cqes, expected) != 0)
+        {
+            return ERROR;
+        }
+
+        for (unsigned i = 0; i < expected; i++)
+        {
+            uint64_t kind = cqes[i].user_data & URING_KIND_MASK;
+            unsigned index = cqes[i].user_data & ~URING_KIND_MASK;
+
+            if (kind == URING_KIND_READ)
+            {
+                chunks[set][index].res = cqes[i].res;
+            }
+            else
+            {
+                chunks[!set][index].res = cqes[i].res;
+            }
+        }
+
+        /* Linked sends stop at the first short one, finish that tail in order */
+        for (unsigned i = 0; i < num_sends; i++)
+        {
+            uring_chunk_t *chunk = &chunks[!set][i];
+            ssize_t done = (chunk->res > 0) ? chunk->res : 0;
+            if ((size_t)done < chunk->len)
+            {
+                const char *chunk_buf = ring->bufs + (!set * URING_REPLAY_BATCH + i) * URING_REPLAY_CHUNK;
+                if ((chunk->res < 0) && (chunk->res != -ECANCELED))
+                {
+                    aesd_log(LOG_ERR, "uring: Send to client failed: %s", strerror(-chunk->res));
+                    return ERROR;
+                }
+                if (send_all(client_fd, chunk_buf + done, chunk->len - done) != 0)
+                {
+                    aesd_log(LOG_ERR, "uring: Send to client failed: %s", strerror(errno));
+                    return ERROR;
+                }
+            }
+        }
+
+        /* A read cut short (or cancelled behind one) is redone synchronously */
+        for (unsigned i = 0; i < num_reads[set]; i++)
+        {
+            uring_chunk_t *chunk = &chunks[set][i];
+            char *chunk_buf = ring->bufs + (set * URING_REPLAY_BATCH + i) * URING_REPLAY_CHUNK;
+            ssize_t done = (chunk->res > 0) ? chunk->res : 0;
+            while ((size_t)done < chunk->len)
+            {
+                ssize_t got = pread(file_fd, chunk_buf + done, chunk->len - done, chunk->offset + done);
+                if (got <= 0)
+                {
+                    aesd_log(LOG_ERR, "uring: Read from file failed");
+                    return ERROR;
+                }
+                done += got;
+            }
+        }
+
+        /* Send this batch as a linked chain and read the next one alongside it */
+        num_sends = num_reads[set];
+        for (unsigned i = 0; i < num_sends; i++)
+        {
+            uring_chunk_t *chunk = &chunks[set][i];
+            sqe = uring_get_sqe(ring);
+            uring_prep(sqe, IORING_OP_SEND, client_fd, ring->bufs + (set * URING_REPLAY_BATCH + i) * URING_REPLAY_CHUNK,
+                       chunk->len, 0, URING_KIND_SEND | i);
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            chunk->res = -ECANCELED;
+            if (i + 1 < num_sends)
+            {
+                sqe->flags |= IOSQE_IO_LINK;
+            }
+        }
+
+        set = !set;
+        num_reads[set] = queue_reads(ring, chunks[set], set, file_fd, offset, end);
+        if (num_reads[set] > 0)
+        {
+            offset = chunks[set][num_reads[set] - 1].offset + chunks[set][num_reads[set] - 1].len;
+        }
+        expected = num_sends + num_reads[set];
+    }
+
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesd-uring.h
+ * @brief   io_uring I/O engine for aesdsocket
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESD_URING_H
+#define AESD_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define URING_QUEUE_DEPTH (32)
+#define URING_REPLAY_CHUNK (64 * 1024)  /* Bytes per replay read/send */
+#define URING_REPLAY_BATCH (8)          /* Replay chunks submitted per io_uring_enter */
+
+typedef struct aesd_uring aesd_uring_t;
+
+/**
+ * Check at runtime that the kernel allows io_uring and supports the
+ * recv, write, read and send opcodes used by the engine.
+ */
+bool uring_probe(void);
+
+/**
+ * @return the calling thread's ring, created on first use and released when
+ * the thread exits, or NULL if the engine is disabled or the ring failed.
+ */
+aesd_uring_t *uring_thread_ring(void);
+
+/**
+ * recv() through the ring.
+ * @return bytes received, 0 on peer close, ERROR with errno set on failure
+ */
+ssize_t uring_recv(aesd_uring_t *ring, int fd, void *buf, size_t len);
+
+/**
+ * Send [offset, end) of file_fd to client_fd. Each batch of linked sends
+ * shares one submission with the reads of the next batch. No lock is needed,
+ * the range below the published end of the log never changes.
+ * @return 0 on success, ERROR on failure
+ */
+int uring_replay(aesd_uring_t *ring, int file_fd, int client_fd, off_t offset, off_t end);
+
+#endif /* AESD_URING_H */
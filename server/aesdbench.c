@@ -0,0 +1,495 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesdbench.c
+ * @brief   Load generator and latency benchmark for aesdsocket
+ *
+ * Opens M concurrent connections to the server and sends N packets on each,
+ * optionally paced to a fixed rate and mixed with AESDCHAR_IOCSEEKTO commands.
+ * For every packet it records
+ *   append: from the send (or the connect, one packet per connection) to the
+ *           first reply byte, the server only replays after the append is done
+ *   replay: from the first to the last reply byte
+ * and reports throughput plus p50/p99/p999 of both. When pacing, latency is
+ * measured from the scheduled send time so a stalled server is not hidden.
+ *
+ * The tool only speaks the socket protocol, so it runs the same against the
+ * file and the char device backends. With -k the server must also run with
+ * -k; a reply then ends at the client's own packet, which only the file
+ * backend guarantees. A seek command is never appended, so -k and -S do not
+ * mix. A reply that never ends as expected times out after
+ * BENCH_RECV_TIMEOUT_S and counts as an error.
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define ERROR (-1)
+#define BENCH_RECV_SIZE (64 * 1024)
+#define BENCH_MIN_PACKET (32)
+#define BENCH_RECV_TIMEOUT_S (5)    /* A reply silent this long counts as an error */
+#define AESD_SEEK_CMD "AESDCHAR_IOCSEEKTO:"
+
+typedef enum
+{
+    SAMPLE_APPEND = 0,
+    SAMPLE_REPLAY,
+    SAMPLE_SEEK,
+    SAMPLE_KINDS,
+} sample_kind_t;
+
+static const char *sample_names[SAMPLE_KINDS] = { "append", "replay", "seek" };
+
+typedef struct bench_config
+{
+    const char *host;
+    const char *port;
+    int connections;
+    int packets;
+    size_t packet_size;
+    double rate;                /* Packets per second per connection, 0 for open loop */
+    int seek_percent;           /* Share of packets sent as seek commands */
+    bool keep_alive;
+} bench_config_t;
+
+typedef struct bench_worker
+{
+    pthread_t thread_id;
+    int id;
+    uint64_t *samples[SAMPLE_KINDS];   /* Nanoseconds */
+    size_t counts[SAMPLE_KINDS];
+    uint64_t bytes_sent;
+    uint64_t bytes_replayed;
+    int errors;
+} bench_worker_t;
+
+static bench_config_t bench = {
+    .host = "127.0.0.1", .port = "9000", .connections = 8, .packets = 100,
+    .packet_size = 64, .rate = 0, .seek_percent = 0, .keep_alive = false,
+};
+static struct addrinfo *server_addr;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+    struct timespec ts = { .tv_sec = deadline / 1000000000ULL, .tv_nsec = deadline % 1000000000ULL };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+static int bench_connect(void)
+{
+    int fd = socket(server_addr->ai_family, server_addr->ai_socktype, server_addr->ai_protocol);
+    if (fd == ERROR)
+    {
+        return ERROR;
+    }
+    struct timeval timeout = { .tv_sec = BENCH_RECV_TIMEOUT_S, .tv_usec = 0 };
+    if ((setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) ||
+        (connect(fd, server_addr->ai_addr, server_addr->ai_addrlen) != 0))
+    {
+        close(fd);
+        return ERROR;
+    }
+    return fd;
+}
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+        if (sent == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return ERROR;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+/* Unique, newline terminated packet so a keep-alive reply can be delimited */
+static size_t build_packet(char *packet, int worker_id, int seq, bool seek)
+{
+    if (seek)
+    {
+        return snprintf(packet, bench.packet_size, "%s0,0\n", AESD_SEEK_CMD);
+    }
+
+    int header = snprintf(packet, bench.packet_size, "bench-%04d-%08d-", worker_id, seq);
+    for (size_t i = header; i < bench.packet_size - 1; i++)
+    {
+        packet[i] = 'a' + (i % 26);
+    }
+    packet[bench.packet_size - 1] = '\n';
+    return bench.packet_size;
+}
+
+/**
+ * Read one reply. One packet per connection: until the server closes.
+ * Keep-alive: until the reply ends with the packet just sent.
+ * @return 0 on success, ERROR on failure
+ */
+static int read_reply(int fd, const char *packet, size_t packet_len, char *buf, char *tail,
+                      uint64_t *first_byte, uint64_t *replayed)
+{
+    size_t tail_len = 0;
+    *first_byte = 0;
+    *replayed = 0;
+
+    while (1)
+    {
+        ssize_t length = recv(fd, buf, BENCH_RECV_SIZE, 0);
+        if (length == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return ERROR;
+        }
+        if (length == 0)
+        {
+            /* A keep-alive server must not close mid reply */
+            return (bench.keep_alive || (*replayed == 0)) ? ERROR : 0;
+        }
+        if (*first_byte == 0)
+        {
+            *first_byte = now_ns();
+        }
+        *replayed += length;
+
+        if (bench.keep_alive)
+        {
+            /* Keep the last packet_len bytes of the reply */
+            if ((size_t)length >= packet_len)
+            {
+                memcpy(tail, buf + length - packet_len, packet_len);
+                tail_len = packet_len;
+            }
+            else
+            {
+                size_t keep = (tail_len + length > packet_len) ? packet_len - length : tail_len;
+                memmove(tail, tail + tail_len - keep, keep);
+                memcpy(tail + keep, buf, length);
+                tail_len = keep + length;
+            }
+            if ((tail_len == packet_len) && (memcmp(tail, packet, packet_len) == 0))
+            {
+                return 0;
+            }
+        }
+    }
+}
+
+static void record(bench_worker_t *worker, sample_kind_t kind, uint64_t value)
+{
+    worker->samples[kind][worker->counts[kind]++] = value;
+}
+
+static void *threadfn_worker(void *worker_struct)
+{
+    bench_worker_t *worker = (bench_worker_t*)worker_struct;
+    char *packet = malloc(bench.packet_size);
+    char *tail = malloc(bench.packet_size);
+    char *buf = malloc(BENCH_RECV_SIZE);
+    unsigned int seed = (unsigned int)worker->id * 2654435761u;
+    uint64_t start = now_ns();
+    int fd = -1;
+    int seq;
+
+    if ((packet == NULL) || (tail == NULL) || (buf == NULL))
+    {
+        worker->errors = bench.packets;
+        goto worker_exit;
+    }
+
+    for (seq = 0; seq < bench.packets; seq++)
+    {
+        bool seek = (bench.seek_percent > 0) && ((int)(rand_r(&seed) % 100) < bench.seek_percent);
+        size_t packet_len = build_packet(packet, worker->id, seq, seek);
+        uint64_t t_send, first_byte, replayed;
+
+        if (bench.rate > 0)
+        {
+            /* Latency counts from the schedule, not from when we got to send */
+            t_send = start + (uint64_t)(seq * 1e9 / bench.rate);
+            sleep_until_ns(t_send);
+        }
+        else
+        {
+            t_send = now_ns();
+        }
+
+        if (fd == -1)
+        {
+            fd = bench_connect();
+            if (fd == ERROR)
+            {
+                fd = -1;
+                worker->errors++;
+                continue;
+            }
+        }
+
+        if ((send_all(fd, packet, packet_len) != 0) ||
+            (read_reply(fd, packet, packet_len, buf, tail, &first_byte, &replayed) != 0))
+        {
+            worker->errors++;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        uint64_t t_done = now_ns();
+
+        worker->bytes_sent += packet_len;
+        worker->bytes_replayed += replayed;
+        record(worker, seek ? SAMPLE_SEEK : SAMPLE_APPEND, first_byte - t_send);
+        record(worker, SAMPLE_REPLAY, t_done - first_byte);
+
+        if (!bench.keep_alive)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+worker_exit:
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    free(packet);
+    free(tail);
+    free(buf);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const uint64_t *sorted, size_t count, double pct)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    size_t index = (size_t)(pct / 100.0 * (count - 1) + 0.5);
+    return sorted[index] / 1000.0;
+}
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-H host] [-p port] [-c connections] [-n packets] [-s size] [-r rate] [-S percent] [-k]\n", prog);
+    fprintf(stderr, "  -H  server host (default: 127.0.0.1)\n");
+    fprintf(stderr, "  -p  server port (default: 9000)\n");
+    fprintf(stderr, "  -c  concurrent connections (default: 8)\n");
+    fprintf(stderr, "  -n  packets per connection (default: 100)\n");
+    fprintf(stderr, "  -s  packet size in bytes including the newline (default: 64, minimum: %d)\n", BENCH_MIN_PACKET);
+    fprintf(stderr, "  -r  packets per second per connection, 0 sends back to back (default: 0)\n");
+    fprintf(stderr, "  -S  percent of packets sent as AESDCHAR_IOCSEEKTO:0,0 commands (char device backend)\n");
+    fprintf(stderr, "  -k  send every packet of a connection on one socket (server started with -k, not with -S)\n");
+}
+
+static bool parse_args(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:c:n:s:r:S:k")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H':
+                bench.host = optarg;
+                break;
+
+            case 'p':
+                bench.port = optarg;
+                break;
+
+            case 'c':
+                bench.connections = atoi(optarg);
+                break;
+
+            case 'n':
+                bench.packets = atoi(optarg);
+                break;
+
+            case 's':
+                bench.packet_size = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'r':
+                bench.rate = atof(optarg);
+                break;
+
+            case 'S':
+                bench.seek_percent = atoi(optarg);
+                break;
+
+            case 'k':
+                bench.keep_alive = true;
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    return (bench.connections > 0) && (bench.packets > 0) && (bench.packet_size >= BENCH_MIN_PACKET) &&
+           (bench.rate >= 0) && (bench.seek_percent >= 0) && (bench.seek_percent <= 100) &&
+           /* A keep-alive reply ends at the packet sent, a seek command never shows up in it */
+           !(bench.keep_alive && (bench.seek_percent > 0));
+}
+
+int main(int argc, char **argv)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    int retval = EXIT_FAILURE;
+    int started = 0;
+    int i, kind;
+
+    if (!parse_args(argc, argv))
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (getaddrinfo(bench.host, bench.port, &hints, &server_addr) != 0)
+    {
+        fprintf(stderr, "aesdbench: Cannot resolve %s:%s\n", bench.host, bench.port);
+        return EXIT_FAILURE;
+    }
+
+    bench_worker_t *workers = calloc(bench.connections, sizeof(bench_worker_t));
+    if (workers == NULL)
+    {
+        goto bench_exit;
+    }
+    for (i = 0; i < bench.connections; i++)
+    {
+        workers[i].id = i;
+        for (kind = 0; kind < SAMPLE_KINDS; kind++)
+        {
+            workers[i].samples[kind] = malloc(bench.packets * sizeof(uint64_t));
+            if (workers[i].samples[kind] == NULL)
+            {
+                goto bench_free;
+            }
+        }
+    }
+
+    uint64_t start = now_ns();
+    for (i = 0; i < bench.connections; i++)
+    {
+        if (pthread_create(&workers[i].thread_id, NULL, threadfn_worker, &workers[i]) != 0)
+        {
+            fprintf(stderr, "aesdbench: Thread creation failed\n");
+            break;
+        }
+        started++;
+    }
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(workers[i].thread_id, NULL);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    /* Merge the per worker samples */
+    uint64_t bytes_sent = 0, bytes_replayed = 0;
+    size_t total[SAMPLE_KINDS] = { 0 };
+    int errors = 0;
+    for (i = 0; i < started; i++)
+    {
+        bytes_sent += workers[i].bytes_sent;
+        bytes_replayed += workers[i].bytes_replayed;
+        errors += workers[i].errors;
+        for (kind = 0; kind < SAMPLE_KINDS; kind++)
+        {
+            total[kind] += workers[i].counts[kind];
+        }
+    }
+
+    printf("aesdbench: %d connections x %d packets of %zu bytes, %d%% seek commands, %s\n",
+           started, bench.packets, bench.packet_size, bench.seek_percent,
+           bench.keep_alive ? "keep-alive" : "one packet per connection");
+    printf("elapsed %.3f s, %.1f packets/s, sent %.3f MB/s, replayed %.3f MB/s, errors %d\n",
+           elapsed, total[SAMPLE_REPLAY] / elapsed, bytes_sent / elapsed / 1e6, bytes_replayed / elapsed / 1e6, errors);
+    printf("%-8s %10s %12s %12s %12s %12s\n", "", "count", "p50 (us)", "p99 (us)", "p999 (us)", "max (us)");
+
+    for (kind = 0; kind < SAMPLE_KINDS; kind++)
+    {
+        uint64_t *merged = malloc((total[kind] + 1) * sizeof(uint64_t));
+        size_t n = 0;
+        if (merged == NULL)
+        {
+            goto bench_free;
+        }
+        for (i = 0; i < started; i++)
+        {
+            memcpy(merged + n, workers[i].samples[kind], workers[i].counts[kind] * sizeof(uint64_t));
+            n += workers[i].counts[kind];
+        }
+        qsort(merged, n, sizeof(uint64_t), compare_u64);
+        printf("%-8s %10zu %12.1f %12.1f %12.1f %12.1f\n", sample_names[kind], n,
+               percentile_us(merged, n, 50), percentile_us(merged, n, 99), percentile_us(merged, n, 99.9),
+               (n > 0) ? merged[n - 1] / 1000.0 : 0);
+        free(merged);
+    }
+
+    retval = (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+bench_free:
+    for (i = 0; i < bench.connections; i++)
+    {
+        for (kind = 0; kind < SAMPLE_KINDS; kind++)
+        {
+            free(workers[i].samples[kind]);
+        }
+    }
+    free(workers);
+
+bench_exit:
+    freeaddrinfo(server_addr);
+    return retval;
+}
@@ -20,7 +20,7 @@
  * 3. https://blog.taborkelly.net/programming/c/2016/01/09/sys-queue-example.html
  * 4. https://linux.die.net/man/2/clock_gettime
  * 5. https://man7.org/linux/man-pages/man2/clock_nanosleep.2.html
- * 6. 
+ * 6. https://man7.org/linux/man-pages/man3/getopt.3.html
  */
 
 #define _POSIX_C_SOURCE 200112L  // Enable POSIX features
@@ -44,50 +44,72 @@
 #include <stdatomic.h>
 #include <time.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <unistd.h>
 #include "../aesd-char-driver/aesd_ioctl.h"
 #include <linux/stat.h>
 #include <sys/stat.h>
+#include "aesdsocket.h"
+#include "aesd-log.h"
+#include "aesd-reactor.h"
+#include "aesd-pool.h"
+#include "aesd-uring.h"
+#include "aesd-replay.h"
+#include "aesd-mirror.h"
+#include "aesd-storage.h"
+#include "aesd-framing.h"
+#include "aesd-bufpool.h"
+#include "aesd-timestamp.h"
+#include "aesd-stats.h"
+#include "aesd-binary.h"
+#include "aesd-admission.h"
+#include "aesd-timer.h"
 
-#define ERROR (-1)
-#define BACKLOG (10)
 #define PORT_NUM (9000)
-#define BUF_INITIAL_SIZE (1024)
-#define TIMESTAMP_INTERVAL (10)
-
-/* Build switch */
-#define USE_AESD_CHAR_DEVICE (1)
-
-#if (USE_AESD_CHAR_DEVICE == 1)
-    #define FILE_NAME "/dev/aesdchar"
-#elif (USE_AESD_CHAR_DEVICE == 0)
-	#define FILE_NAME "/var/tmp/aesdsocketdata"
-#endif
+#define KEEPALIVE_POLL_MS (1000)        /* How often idle keep-alive connections check for a signal */
+#define PEER_CLOSED (1)
 
 int sockfd;
 struct addrinfo *res;  // will point to the results
 volatile sig_atomic_t caught_signal = 0;
-char *aesd_ioctl_seek_cmd = "AESDCHAR_IOCSEEKTO:";
+char *aesd_ioctl_seek_cmd = AESD_SEEK_CMD;
+aesd_config_t config = { .is_daemon = false, .mode = SERVER_MODE_THREAD, .event_loops = 0, .reuse_port = false, .workers = 0, .use_uring = false, .use_mirror = false, .use_mmap = false, .replay_flush = REPLAY_FLUSH_DEFAULT, .keep_alive = false, .coalesce_replay = false, .timestamp_interval = TIMESTAMP_INTERVAL, .log_level = LOG_INFO, .stats_path = STATS_SOCKET_PATH, .segment_size = 0, .retain_bytes = 0, .retain_segments = STORAGE_MAX_SEGMENTS, .retain_age = 0, .group_commit = false, .durability = DURABILITY_NONE, .sync_strict = false, .max_connections = 0, .max_packet = 0, .rate_bytes = 0, .rate_packets = 0, .idle_timeout = 0, .stall_timeout = 0 };
 
 /* The structure for the linked list that will manage server threads*/
 typedef struct server_thread_params
 {
     pthread_t thread_id;
-    volatile bool thread_complete;
     int client_fd;
     char client_ip[INET_ADDRSTRLEN];        /* Size for IPv4 addresses */
-    pthread_mutex_t *tmp_file_write_mutex;
-    SLIST_ENTRY(server_thread_params) link;
+    timer_entry_t timer;                    /* Idle or write stall deadline, in conn_timers */
+    bool replaying;                         /* The deadline is a write stall one */
+    int outq;                               /* Unsent bytes when the stall deadline last fired, -1 before */
+    LIST_ENTRY(server_thread_params) link;  /* Running threads, owned by the accept loop */
+    struct server_thread_params *done_next; /* Completion stack link */
 } server_thread_params_t;
 
-/* The structure for the timestamp thread*/
-typedef struct time_thread_params
+typedef LIST_HEAD(socket_head,server_thread_params) head_t;
+
+/* Accept loop poll set */
+enum
 {
-    pthread_t thread_id;
-    pthread_mutex_t *tmp_file_write_mutex;
-} time_thread_params_t;
+    ACCEPT_FD_LISTEN = 0,
+    ACCEPT_FD_TIMER,
+    ACCEPT_FD_STATS,
+    ACCEPT_FD_REAP,
+    ACCEPT_FDS,
+};
+
+/* Deadlines of connection threads, advanced by the accept loop */
+static timer_wheel_t conn_timers;
+static pthread_mutex_t conn_timers_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-typedef SLIST_HEAD(socket_head,server_thread_params) head_t;
+/* Finished connection threads, pushed lock-free and taken whole by the accept loop */
+static _Atomic(server_thread_params_t*) done_head = NULL;
+static int reap_fd = -1;
 
 void cleanup() 
 {
@@ -116,7 +138,7 @@ bool create_daemon ()
 
     if (pid < 0)
     {
-        syslog(LOG_ERR, "Fork failed");
+        aesd_log(LOG_ERR, "Fork failed");
         goto daemon_exit;
     }
 
@@ -129,36 +151,36 @@ bool create_daemon ()
     /* Create a new session */
     if (setsid() == -1)
     {
-        syslog(LOG_ERR, "Failed to create a new session");
+        aesd_log(LOG_ERR, "Failed to create a new session");
         goto daemon_exit;
     }
 
     /* Change the working directory and redirect std file descriptors*/ 
     if ((ret_chdir = chdir("/")) == ERROR)
     {
-        syslog(LOG_ERR, "Failed to change directory");
+        aesd_log(LOG_ERR, "Failed to change directory");
     }
 
     if ((file = open("/dev/null", O_RDWR)) == ERROR)
     {
-        syslog(LOG_ERR, "Failed to open /dev/null");
+        aesd_log(LOG_ERR, "Failed to open /dev/null");
         goto daemon_exit;
     }
 
     if ((ret_stdin = dup2(file, STDIN_FILENO)) == ERROR) 
     {
-        syslog(LOG_ERR, "Failed to redirect stdin");
+        aesd_log(LOG_ERR, "Failed to redirect stdin");
     }
 
 
     if ((ret_stdout = dup2(file, STDOUT_FILENO)) == ERROR) 
     {
-        syslog(LOG_ERR, "Failed to redirect stdout");
+        aesd_log(LOG_ERR, "Failed to redirect stdout");
     }
 
     if ((ret_stderr = dup2(file, STDERR_FILENO)) == ERROR) 
     {
-        syslog(LOG_ERR, "Failed to redirect stderr");
+        aesd_log(LOG_ERR, "Failed to redirect stderr");
     }
 
     if ((ret_chdir != ERROR) && (ret_stdin != ERROR) && (ret_stdout != ERROR) && (ret_stderr != ERROR))
@@ -177,272 +199,871 @@ static void signal_handler (int signal_number)
     caught_signal = signal_number;
 }
 
-#if (USE_AESD_CHAR_DEVICE == 0)
-void *threadfn_timestamp(void *time_thread_params_struct)
+/* Keep-alive connections idle in here, wake up now and then to notice a caught signal */
+static bool wait_for_data(int client_fd)
 {
-    time_thread_params_t *time_params = (time_thread_params_t*)time_thread_params_struct;
-    if (time_params == NULL)
+    struct pollfd pfd = { .fd = client_fd, .events = POLLIN };
+
+    while (!caught_signal)
     {
-        syslog(LOG_ERR, "threadfn_timestamp: Time thread struct is NULL");
-        goto threadfn_timestamp_exit;
+        int ret = poll(&pfd, 1, KEEPALIVE_POLL_MS);
+        if ((ret > 0) || ((ret == ERROR) && (errno != EINTR)))
+        {
+            /* Readable, closed or failed, recv reports which */
+            return true;
+        }
     }
+    return false;
+}
 
-    struct timespec wall_time;
-    char outstr[300];
-    time_t t;
-    struct tm *tmp;
-    int file_fd = -1;
+/**
+ * Set the deadline of a connection thread: idle while it waits for a packet,
+ * write stall while it replays. No deadline when that timeout is off.
+ */
+static void conn_timer_arm(server_thread_params_t *server_params, bool replaying)
+{
+    int timeout = replaying ? config.stall_timeout : config.idle_timeout;
 
-    /* Run until a signal caught */
-    while(!caught_signal)
+    if ((config.idle_timeout == 0) && (config.stall_timeout == 0))
     {
-        t = time(NULL);
-        tmp = localtime(&t);
-        if (tmp == NULL) 
-        {
-            syslog(LOG_ERR, "threadfn_timestamp: Localtime");
-            goto threadfn_timestamp_exit;
-        }
+        return;
+    }
+    pthread_mutex_lock(&conn_timers_mutex);
+    if (timeout > 0)
+    {
+        server_params->replaying = replaying;
+        server_params->outq = -1;
+        timer_arm(&conn_timers, &server_params->timer, stats_now(), timeout * 1000);
+    }
+    else
+    {
+        timer_cancel(&conn_timers, &server_params->timer);
+    }
+    pthread_mutex_unlock(&conn_timers_mutex);
+}
 
-        if (clock_gettime(CLOCK_MONOTONIC, &wall_time) != 0)
-        {
-            syslog(LOG_ERR, "threadfn_timestamp: Failed clock_gettime");
-            continue;
-        }
+/* Clear the deadline before the descriptor is closed, an expiry must never reach a reused fd */
+static void conn_timer_cancel(server_thread_params_t *server_params)
+{
+    if ((config.idle_timeout == 0) && (config.stall_timeout == 0))
+    {
+        return;
+    }
+    pthread_mutex_lock(&conn_timers_mutex);
+    timer_cancel(&conn_timers, &server_params->timer);
+    pthread_mutex_unlock(&conn_timers_mutex);
+}
 
-        wall_time.tv_sec += TIMESTAMP_INTERVAL;
+/**
+ * Deadline of a connection thread passed, called under conn_timers_mutex.
+ * The thread is blocked in recv or a send, shutdown wakes it with an error.
+ * A replay is only cut once the socket's send queue sat unchanged for a whole
+ * timeout, a slow client that keeps reading is left alone.
+ */
+static void conn_timer_expired(timer_entry_t *timer, void *unused)
+{
+    server_thread_params_t *server_params = (server_thread_params_t*)timer->data;
+    int outq = 0;
+
+    if (server_params->replaying &&
+        ((ioctl(server_params->client_fd, SIOCOUTQ, &outq) == ERROR) || (outq == 0) || (outq != server_params->outq)))
+    {
+        server_params->outq = outq;
+        timer_arm(&conn_timers, timer, stats_now(), config.stall_timeout * 1000);
+        return;
+    }
 
-        /* Sleep for 10 seconds */
-        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wall_time, NULL);
+    aesd_log(LOG_DEBUG, "Connection from %s timed out", server_params->client_ip);
+    stats_add(STATS_EXPIRED, 1);
+    shutdown(server_params->client_fd, SHUT_RDWR);
+}
 
-        if (strftime(outstr, sizeof(outstr),"timestamp: %Y/%m/%d %H:%M:%S\n", tmp) == 0) 
+/* Binary sessions always last until the client closes */
+static bool session_continues(const frame_buffer_t *rx)
+{
+    return config.keep_alive || (rx->protocol == FRAME_BINARY);
+}
+
+/**
+ * Receive until a complete packet is buffered.
+ * @return the packet length, 0 if the peer closed first, ERROR on failure
+ */
+static ssize_t receive_packet(server_thread_params_t *server_params, frame_buffer_t *rx, aesd_uring_t *ring)
+{
+    ssize_t length;
+    size_t packet_len;
+    size_t space;
+    char *recv_ptr;
+
+    while ((packet_len = frame_next_packet(rx)) == 0)
+    {
+        /* Over its rate, wait before reading or growing anything for it */
+        if (!admission_wait(server_params->client_ip))
         {
-            syslog(LOG_ERR, "threadfn_timestamp: strftime failed");
-            continue;
+            return ERROR;
         }
 
-        file_fd = open(FILE_NAME, O_CREAT | O_RDWR | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-        if (file_fd == ERROR)
+        recv_ptr = frame_recv_space(rx, &space);
+        if (recv_ptr == NULL)
         {
-            syslog(LOG_ERR, "threadfn_timestamp: Failed to open write file %s", strerror(errno));
-            goto threadfn_timestamp_exit;
+            aesd_log(LOG_ERR, "receive_data: No room to receive the packet");
+            return ERROR;
         }
+        space = admission_recv_size(space);
 
-        /* Lock mutex before writing to tmp file and set file position*/
-        if (pthread_mutex_lock(time_params->tmp_file_write_mutex) != 0)
+        /* Every wait for data gets a fresh idle deadline */
+        conn_timer_arm(server_params, false);
+
+        if (session_continues(rx) && !wait_for_data(server_params->client_fd))
         {
-            syslog(LOG_ERR, "threadfn_timestamp: Failed to lock mutex");
-            goto threadfn_timestamp_close_file;
+            return 0;
         }
 
-        if (lseek(file_fd, 0, SEEK_END) == -1)
+        if (ring != NULL)
         {
-            syslog(LOG_ERR, "threadfn_timestamp: Failed to seek to end of file: %s", strerror(errno));
-            pthread_mutex_unlock(time_params->tmp_file_write_mutex);
-            goto threadfn_timestamp_close_file;
+            length = uring_recv(ring, server_params->client_fd, recv_ptr, space);
         }
-        size_t write_bytes = write(file_fd, outstr, strlen(outstr));
-        
-        pthread_mutex_unlock(time_params->tmp_file_write_mutex);
-
-        if (write_bytes < 0)
+        else
         {
-            syslog(LOG_ERR, "threadfn_timestamp: Timestamp write failed");
-            goto threadfn_timestamp_close_file;
+            length = recv(server_params->client_fd, recv_ptr, space, 0);
         }
-
-        if (file_fd != -1)
+        if (length == ERROR)
+        {
+            aesd_log(LOG_ERR, "receive_data: Receive failed");
+            return ERROR;
+        }
+        if (length == 0)
         {
-            close(file_fd);
-            file_fd = -1;
+            return 0;
         }
+        frame_received(rx, length);
+        stats_add(STATS_BYTES_IN, length);
+        admission_charge(server_params->client_ip, length, 0);
     }
 
-threadfn_timestamp_close_file:
-    if (file_fd != -1)
+    return packet_len;
+}
+
+typedef struct replay_span_ctx
+{
+    int client_fd;
+    aesd_uring_t *ring;
+} replay_span_ctx_t;
+
+static replay_status_t replay_span_zero_copy(void *arg, int file_fd, const char *file_map, off_t *offset, off_t end)
+{
+    replay_span_ctx_t *ctx = (replay_span_ctx_t*)arg;
+    if (file_map != NULL)
     {
-        close(file_fd);
-        file_fd = -1;
+        return replay_mapped(ctx->client_fd, file_map, offset, end);
     }
+    return replay_zero_copy(ctx->client_fd, file_fd, offset, end);
+}
 
-threadfn_timestamp_exit:
-    return NULL;
+#if (USE_AESD_CHAR_DEVICE == 0)
+static replay_status_t replay_span_uring(void *arg, int file_fd, const char *file_map, off_t *offset, off_t end)
+{
+    replay_span_ctx_t *ctx = (replay_span_ctx_t*)arg;
+    if (file_map != NULL)
+    {
+        return replay_mapped(ctx->client_fd, file_map, offset, end);
+    }
+    if (uring_replay(ctx->ring, file_fd, ctx->client_fd, *offset, end) != 0)
+    {
+        return REPLAY_ERROR;
+    }
+    *offset = end;
+    return REPLAY_DONE;
 }
 #endif
 
-int receive_and_process_data(server_thread_params_t *server_params, char *buf, size_t receive_buf_size)
+/* Send [offset, end) of the log back to the client, end of -1 means up to end of file */
+static int replay_log(server_thread_params_t *server_params, aesd_uring_t *ring, off_t offset, off_t end)
 {
-    syslog(LOG_DEBUG, "in receive_and_process_data");
-    int length;
-    size_t total_received = 0;
-    char *end_packet = NULL;
-    int retval = 0;
-    
-    /* Changed implementation from file pointer to file descriptor for ease */
-    int file_fd = -1;
-    file_fd = open(FILE_NAME, O_CREAT | O_RDWR | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-    if (file_fd == ERROR)
+    replay_status_t replay_status;
+    replay_span_ctx_t ctx = { .client_fd = server_params->client_fd, .ring = ring };
+    uint64_t started = stats_now();
+    off_t from = (offset == 0) ? storage_start() : offset;     /* Retention may have dropped the head */
+    bool corked = replay_should_cork(offset, end);
+
+    aesd_log(LOG_DEBUG, "in send_response");
+    conn_timer_arm(server_params, true);
+
+    /* Only full segments leave while a large replay is sent in pieces */
+    if (corked)
+    {
+        replay_cork(server_params->client_fd, true);
+    }
+
+    /* Everything below end is published, the replay itself holds no lock */
+    if (mirror_enabled() && (end >= 0) && ((off_t)mirror_length() >= end))
     {
-        syslog(LOG_ERR, "process_data: Failed to open write file %s", strerror(errno));
-        retval = ERROR;
-        goto update_exit;
+        /* Serve the replay from memory */
+        replay_status = mirror_send(server_params->client_fd, &offset, end);
+        goto replay_done;
     }
 
-    do 
+#if (USE_AESD_CHAR_DEVICE == 0)
+    if (ring != NULL)
     {
-        if (total_received + 1 >= receive_buf_size)
+        /* Replay through batched io_uring submissions */
+        replay_status = storage_replay_spans(&offset, end, replay_span_uring, &ctx);
+        goto replay_done;
+    }
+#endif
+
+    replay_status = storage_replay_spans(&offset, end, replay_span_zero_copy, &ctx);
+    if (replay_status == REPLAY_UNSUPPORTED)
+    {
+        /* One send per config.replay_flush bytes, however small the reads */
+        size_t copy_size;
+        char *copy_buf = bufpool_get(config.replay_flush, &copy_size);
+        replay_status = (copy_buf != NULL) ? storage_replay_copy(server_params->client_fd, &offset, end, copy_buf, copy_size) : REPLAY_ERROR;
+        bufpool_put(copy_buf, copy_size);
+    }
+
+replay_done:
+    conn_timer_arm(server_params, false);
+    if (corked)
+    {
+        replay_cork(server_params->client_fd, false);
+    }
+    if (replay_status != REPLAY_DONE)
+    {
+        return ERROR;
+    }
+    stats_add(STATS_BYTES_OUT, offset - from);
+    stats_record(STATS_REPLAY_LATENCY, stats_now() - started);
+    return 0;
+}
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+static int send_all(int client_fd, const char *buf, size_t len, int flags)
+{
+    for (size_t sent = 0; sent < len; )
+    {
+        ssize_t ret = send(client_fd, buf + sent, len - sent, MSG_NOSIGNAL | flags);
+        if (ret == ERROR)
         {
-            receive_buf_size *= 2;
-            char *new_buf = realloc(buf, receive_buf_size);
-            if (new_buf == NULL)
+            if (errno == EINTR)
             {
-                syslog(LOG_ERR, "receive_data: Realloc failed for receiving buffer");
-                retval = ERROR;
-                goto update_exit;
+                continue;
             }
-            memset(new_buf + total_received, 0, receive_buf_size - total_received);
-            buf = new_buf;
+            aesd_log(LOG_ERR, "process_data: Send failed: %s", strerror(errno));
+            return ERROR;
         }
+        sent += ret;
+    }
+    return 0;
+}
+
+/* Handle AESDRESUME:<offset>, the delta since offset followed by the next cursor */
+static int resume_log(server_thread_params_t *server_params, aesd_uring_t *ring, const char *packet)
+{
+    char cursor[AESD_CURSOR_SIZE];
+    long long offset;
+    off_t start, end;
+
+    if ((sscanf(packet, AESD_RESUME_CMD "%lld", &offset) != 1) || (storage_resume(offset, &start, &end) != 0))
+    {
+        aesd_log(LOG_ERR, "process_data: Invalid resume offset");
+        return ERROR;
+    }
+    if (replay_log(server_params, ring, start, end) != 0)
+    {
+        return ERROR;
+    }
+
+    int len = snprintf(cursor, sizeof(cursor), AESD_CURSOR_FMT, (long long)end);
+    return send_all(server_params->client_fd, cursor, len, 0);
+}
+
+/* Execute one binary record, send its reply and any log range behind it */
+static int binary_record(server_thread_params_t *server_params, aesd_uring_t *ring, const char *record, size_t record_len)
+{
+    binary_reply_t reply;
+    int retval = ERROR;
+
+    reply.buf = bufpool_get(BINARY_REPLY_SIZE, &reply.size);
+    if (reply.buf == NULL)
+    {
+        aesd_log(LOG_ERR, "process_data: Malloc for binary reply failed");
+        return ERROR;
+    }
+    if (binary_process(record, record_len, &reply) != 0)
+    {
+        goto binary_record_exit;
+    }
+
+    bool replay = (reply.replay_start < reply.replay_end);
+    if (send_all(server_params->client_fd, reply.buf, reply.len, replay ? MSG_MORE : 0) != 0)
+    {
+        goto binary_record_exit;
+    }
+    if (replay && ((replay_log(server_params, ring, reply.replay_start, reply.replay_end) != 0) ||
+                   !binary_replay_intact(&reply)))
+    {
+        goto binary_record_exit;
+    }
+    retval = 0;
+
+binary_record_exit:
+    bufpool_put(reply.buf, reply.size);
+    return retval;
+}
+#endif
+
+
+/**
+ * Serve one batch: wait for a packet, then append every complete packet already
+ * buffered and replay the log after each one, or once after the last one when
+ * replies are coalesced. Bytes past the last newline stay buffered.
+ * @return 0 when the batch was served, PEER_CLOSED, or ERROR
+ */
+int receive_and_process_data(server_thread_params_t *server_params, frame_buffer_t *rx)
+{
+    aesd_log(LOG_DEBUG, "in receive_and_process_data");
+    aesd_uring_t *ring = uring_thread_ring();
+    off_t replay_end = -1;
+    bool replay_pending = false;
+
+    ssize_t packet_len = receive_packet(server_params, rx, ring);
+    if (packet_len <= 0)
+    {
+        return (packet_len == 0) ? PEER_CLOSED : ERROR;
+    }
+
+    do
+    {
+        char *packet = frame_consume(rx, packet_len);
+        admission_charge(server_params->client_ip, 0, 1);
 
-        length = recv(server_params->client_fd, buf + total_received, receive_buf_size - total_received - 1, 0);
-        if (length == -1)
+#if (USE_AESD_CHAR_DEVICE == 0)
+        if (rx->protocol == FRAME_BINARY)
         {
-            syslog(LOG_ERR, "receive_data: Receive failed");
-            retval = ERROR;
-            goto update_exit;
+            if (binary_record(server_params, ring, packet, packet_len) != 0)
+            {
+                return ERROR;
+            }
+            continue;
         }
+#endif
 
 #if (USE_AESD_CHAR_DEVICE == 1)
-        if (strncmp(buf, aesd_ioctl_seek_cmd, strlen(aesd_ioctl_seek_cmd)) == 0)
+        if (strncmp(packet, aesd_ioctl_seek_cmd, strlen(aesd_ioctl_seek_cmd)) == 0)
         {
-            syslog(LOG_DEBUG, "in ioctl section");
+            aesd_log(LOG_DEBUG, "in ioctl section");
             struct aesd_seekto seekto;
-            if (sscanf(buf, "AESDCHAR_IOCSEEKTO:%d,%d", &seekto.write_cmd, &seekto.write_cmd_offset) != 2)
+            off_t replay_offset;
+            packet[packet_len - 1] = '\0';
+            if (sscanf(packet, "AESDCHAR_IOCSEEKTO:%d,%d", &seekto.write_cmd, &seekto.write_cmd_offset) != 2)
             {
-                syslog(LOG_ERR, "process_data: number of args != 2");
-                retval = ERROR;
-                goto update_close_file;
+                aesd_log(LOG_ERR, "process_data: number of args != 2");
+                return ERROR;
             }
-            else
+            /* Replay from the position set by the seek command, it also covers pending appends */
+            if (storage_seek(seekto.write_cmd, seekto.write_cmd_offset, &replay_offset) != 0)
             {
-                if(ioctl(file_fd, AESDCHAR_IOCSEEKTO, &seekto) != 0)
-                {
-                    syslog(LOG_ERR, "process_data: ioctl failed");
-                    retval = ERROR;
-                    goto update_close_file;
-                }
+                aesd_log(LOG_ERR, "process_data: ioctl failed");
+                return ERROR;
             }
-            retval = 0; /* Duplicate but precautionary*/
-            goto update_read;
+            if (replay_log(server_params, ring, replay_offset, -1) != 0)
+            {
+                return ERROR;
+            }
+            replay_pending = false;
+            continue;
+        }
+#else
+        if (strncmp(packet, AESD_RESUME_CMD, strlen(AESD_RESUME_CMD)) == 0)
+        {
+            aesd_log(LOG_DEBUG, "in resume section");
+            packet[packet_len - 1] = '\0';
+            if (resume_log(server_params, ring, packet) != 0)
+            {
+                return ERROR;
+            }
+            replay_pending = false;
+            continue;
         }
 #endif
 
-        total_received += length;
-        end_packet = strchr(buf, '\n');
+        if (storage_append(packet, packet_len, &replay_end) != 0)
+        {
+            aesd_log(LOG_ERR, "process_data: Write to temp file failed");
+            return ERROR;
+        }
+        replay_pending = true;
 
-    } while (end_packet == NULL && length > 0);
+        if (!config.coalesce_replay)
+        {
+            if (replay_log(server_params, ring, 0, replay_end) != 0)
+            {
+                return ERROR;
+            }
+            replay_pending = false;
+        }
+    } while (session_continues(rx) && ((packet_len = frame_next_packet(rx)) > 0));
 
-    size_t valid_size = end_packet - buf + 1;
-    buf[valid_size] = '\0';
+    if (replay_pending)
+    {
+        return replay_log(server_params, ring, 0, replay_end);
+    }
+    return 0;
+}
+
+void *threadfn_server(void *server_thread_params_struct)
+{
+    aesd_log(LOG_DEBUG, "in thread");
+    server_thread_params_t *server_params = (server_thread_params_t*)server_thread_params_struct;
+    frame_buffer_t rx = { .data = NULL };
+    int status;
 
-    if (pthread_mutex_lock(server_params->tmp_file_write_mutex) != 0)
+    if (server_params == NULL)
     {
-        syslog(LOG_ERR, "process_data: Failed to lock mutex");
-        goto update_close_file;
+        aesd_log(LOG_ERR, "Thread server_thread_params is NULL");
+        goto threadfn_server_exit;
     }
 
-    size_t written_bytes = write(file_fd, buf, valid_size);
-    pthread_mutex_unlock(server_params->tmp_file_write_mutex);
+    if (frame_buffer_init(&rx) != 0)
+    {
+        aesd_log(LOG_ERR, "Memory allocation failed for receiving buffer");
+        goto threadfn_cleanup;
+    }
 
-    if (written_bytes < valid_size)
+    /* One packet per connection, or a stream of them until the peer closes */
+    do
     {
-        syslog(LOG_ERR, "process_data: Write to temp file failed");
-        retval = ERROR;
-        goto update_close_file;
+        status = receive_and_process_data(server_params, &rx);
+    } while (session_continues(&rx) && (status == 0));
+
+    if (status == ERROR)
+    {
+        aesd_log(LOG_ERR, "receive_and_process_data failed");
     }
 
-    syslog(LOG_DEBUG, "in send_response");
-    size_t read_bytes;
+threadfn_cleanup:
+    frame_buffer_free(&rx);
+    conn_timer_cancel(server_params);
+    close(server_params->client_fd);
+    stats_add(STATS_CONNECTIONS_ACTIVE, -1);
+    admission_release();
+    aesd_log(LOG_DEBUG, "Closed connection from %s", server_params->client_ip);
+
+threadfn_server_exit:
+    return NULL;
+}
+
+/* Thread per connection, queue ourselves for pthread_join and wake the accept loop */
+static void *threadfn_connection(void *server_thread_params_struct)
+{
+    server_thread_params_t *server_params = (server_thread_params_t*)server_thread_params_struct;
+
+    threadfn_server(server_params);
 
-update_read:
-    if (pthread_mutex_lock(server_params->tmp_file_write_mutex) != 0)
+    server_params->done_next = atomic_load_explicit(&done_head, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&done_head, &server_params->done_next, server_params,
+                                                  memory_order_release, memory_order_relaxed))
     {
-        syslog(LOG_ERR, "send_response: Failed to lock mutex");
-        goto update_close_file;
     }
+    if (write(reap_fd, &(uint64_t){1}, sizeof(uint64_t)) != sizeof(uint64_t))
+    {
+        aesd_log(LOG_ERR, "Failed to signal thread completion");
+    }
+    return NULL;
+}
 
-    while ((read_bytes = read(file_fd, buf, receive_buf_size - 1)) > 0)
+/* Join every finished thread, O(1) each, no walk over the running ones */
+static void reap_finished_threads(void)
+{
+    uint64_t count;
+    server_thread_params_t *node;
+    server_thread_params_t *next;
+
+    /* Clear the wakeup, the whole stack is taken below whatever the count */
+    if ((read(reap_fd, &count, sizeof(count)) == ERROR) && (errno != EAGAIN))
     {
-        syslog(LOG_INFO, "Read %s from file", buf);
+        aesd_log(LOG_ERR, "Failed to read thread completions: %s", strerror(errno));
+    }
 
-        if (send(server_params->client_fd, buf, read_bytes, 0) == -1) 
+    node = atomic_exchange_explicit(&done_head, NULL, memory_order_acquire);
+    while (node != NULL)
+    {
+        next = node->done_next;
+        if (pthread_join(node->thread_id, NULL) != 0)
         {
-            syslog(LOG_ERR, "send_response: Send to client failed");
-            pthread_mutex_unlock(server_params->tmp_file_write_mutex);
-            retval = ERROR;
-            goto update_close_file;
+            aesd_log(LOG_ERR, "Thread join failed for %ld", node->thread_id);
         }
-    }
-    
-    pthread_mutex_unlock(server_params->tmp_file_write_mutex);
-    retval = 0;
+        aesd_log(LOG_INFO, "Thread joined %ld", node->thread_id);
 
-update_close_file:
-    if (file_fd != -1)
-    {
-        close(file_fd);
-        file_fd = -1;
+        /* Remove node from the list and free the memory */
+        LIST_REMOVE(node, link);
+        free(node);
+        node = next;
     }
+}
 
-update_exit:
-    return retval;
+static void pool_task_server(void *server_thread_params_struct)
+{
+    threadfn_server(server_thread_params_struct);
+    free(server_thread_params_struct);
 }
 
-void *threadfn_server(void *server_thread_params_struct)
+static void print_usage(const char *prog)
 {
-    syslog(LOG_DEBUG, "in thread");
-    server_thread_params_t *server_params = (server_thread_params_t*)server_thread_params_struct;
-    char *buf = NULL;
+    fprintf(stderr, "Usage: %s [-d] [-k] [-c] [-u] [-M] [-P] [-G] [-D none|interval|batch|packet [-S]] [-m thread|pool|epoll] [-l event_loops] [-R] [-w workers] [-t seconds] [-s stats_socket] [-F bytes] [-L level] [-g bytes [-b bytes] [-n count] [-a seconds]] [-C connections] [-X bytes] [-r bytes] [-p packets] [-I seconds] [-W seconds]\n", prog);
+    fprintf(stderr, "  -d  run as a daemon\n");
+    fprintf(stderr, "  -m  connection model: thread per connection (default), worker pool or epoll event loops\n");
+    fprintf(stderr, "  -l  number of event loop threads in epoll mode (default: one per core)\n");
+    fprintf(stderr, "  -R  with -m epoll, give every event loop its own SO_REUSEPORT listener and pin it to a core\n");
+    fprintf(stderr, "  -w  number of worker threads in pool mode (default: one per core)\n");
+    fprintf(stderr, "  -t  seconds between timestamp records, 0 to disable (default: %d, file backend only)\n", TIMESTAMP_INTERVAL);
+    fprintf(stderr, "  -k  keep connections open for a stream of packets until the client closes (not in pool mode)\n");
+    fprintf(stderr, "  -c  with -k, send one replay per batch of pipelined packets instead of one per packet\n");
+    fprintf(stderr, "  -u  use the io_uring I/O engine in thread and pool modes when the kernel supports it\n");
+    fprintf(stderr, "  -M  serve replays from an in-memory mirror of the data file (file backend only)\n");
+    fprintf(stderr, "  -P  serve replays from a read-only mmap of the data file or its segments (file backend only)\n");
+    fprintf(stderr, "  -G  group commit: one thread writes queued appends in batches with a single pwritev (file backend, not epoll mode)\n");
+    fprintf(stderr, "  -D  fdatasync the log every %d ms, after every batch or after every packet, implies -G (default: none, not epoll mode)\n", STORAGE_SYNC_INTERVAL_MS);
+    fprintf(stderr, "  -S  with -D, answer an append only once a sync covers it\n");
+    fprintf(stderr, "  -F  replay bytes gathered per send, larger replays are sent corked (default: %d)\n", REPLAY_FLUSH_DEFAULT);
+    fprintf(stderr, "  -L  most verbose level logged: err, warning, notice, info or debug (default: info)\n");
+    fprintf(stderr, "  -s  UNIX socket serving live statistics, empty to disable (default: %s)\n", STATS_SOCKET_PATH);
+    fprintf(stderr, "  -g  split the log into segment files of this many bytes, at least %d (file backend only)\n", STORAGE_MIN_SEGMENT);
+    fprintf(stderr, "  -b  with -g, drop the oldest segments once the log is this many bytes\n");
+    fprintf(stderr, "  -n  with -g, keep at most this many segments (default: %d)\n", STORAGE_MAX_SEGMENTS);
+    fprintf(stderr, "  -a  with -g, drop segments older than this many seconds\n");
+    fprintf(stderr, "  -C  refuse connections beyond this many open at once\n");
+    fprintf(stderr, "  -X  close connections sending a packet longer than this many bytes\n");
+    fprintf(stderr, "  -r  bytes per second received from one client address, later bytes wait or are refused\n");
+    fprintf(stderr, "  -p  packets per second served to one client address, later packets wait or are refused\n");
+    fprintf(stderr, "  -I  close connections that send nothing for this many seconds\n");
+    fprintf(stderr, "  -W  close connections whose replay makes no progress for this many seconds\n");
+}
 
-    if (server_params == NULL)
+static bool parse_args(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "dkcuMPGSRD:m:l:w:t:s:F:L:g:b:n:a:C:X:r:p:I:W:")) != -1)
     {
-        syslog(LOG_ERR, "Thread server_thread_params is NULL");
-        goto threadfn_server_exit;
+        switch (opt)
+        {
+            case 'd':
+                config.is_daemon = true;
+                break;
+
+            case 'k':
+                config.keep_alive = true;
+                break;
+
+            case 'c':
+                config.coalesce_replay = true;
+                break;
+
+            case 'u':
+                config.use_uring = true;
+                break;
+
+            case 'M':
+                config.use_mirror = true;
+                break;
+
+            case 'P':
+                config.use_mmap = true;
+                break;
+
+            case 'G':
+                config.group_commit = true;
+                break;
+
+            case 'S':
+                config.sync_strict = true;
+                break;
+
+            case 'R':
+                config.reuse_port = true;
+                break;
+
+            case 'D':
+                if (strcmp(optarg, "none") == 0)
+                {
+                    config.durability = DURABILITY_NONE;
+                }
+                else if (strcmp(optarg, "interval") == 0)
+                {
+                    config.durability = DURABILITY_INTERVAL;
+                }
+                else if (strcmp(optarg, "batch") == 0)
+                {
+                    config.durability = DURABILITY_BATCH;
+                }
+                else if (strcmp(optarg, "packet") == 0)
+                {
+                    config.durability = DURABILITY_PACKET;
+                }
+                else
+                {
+                    return false;
+                }
+                break;
+
+            case 'm':
+                if (strcmp(optarg, "thread") == 0)
+                {
+                    config.mode = SERVER_MODE_THREAD;
+                }
+                else if (strcmp(optarg, "pool") == 0)
+                {
+                    config.mode = SERVER_MODE_POOL;
+                }
+                else if (strcmp(optarg, "epoll") == 0)
+                {
+                    config.mode = SERVER_MODE_EPOLL;
+                }
+                else
+                {
+                    return false;
+                }
+                break;
+
+            case 'l':
+                config.event_loops = atoi(optarg);
+                if (config.event_loops <= 0)
+                {
+                    return false;
+                }
+                break;
+
+            case 'w':
+                config.workers = atoi(optarg);
+                if (config.workers <= 0)
+                {
+                    return false;
+                }
+                break;
+
+            case 't':
+                config.timestamp_interval = atoi(optarg);
+                if (config.timestamp_interval < 0)
+                {
+                    return false;
+                }
+                break;
+
+            case 's':
+                config.stats_path = optarg;
+                break;
+
+            case 'L':
+                if (strcmp(optarg, "err") == 0)
+                {
+                    config.log_level = LOG_ERR;
+                }
+                else if (strcmp(optarg, "warning") == 0)
+                {
+                    config.log_level = LOG_WARNING;
+                }
+                else if (strcmp(optarg, "notice") == 0)
+                {
+                    config.log_level = LOG_NOTICE;
+                }
+                else if (strcmp(optarg, "info") == 0)
+                {
+                    config.log_level = LOG_INFO;
+                }
+                else if (strcmp(optarg, "debug") == 0)
+                {
+                    config.log_level = LOG_DEBUG;
+                }
+                else
+                {
+                    return false;
+                }
+                break;
+
+            case 'F':
+                if (atoi(optarg) <= 0)
+                {
+                    return false;
+                }
+                config.replay_flush = atoi(optarg);
+                break;
+
+            case 'g':
+                config.segment_size = atoll(optarg);
+                if (config.segment_size < STORAGE_MIN_SEGMENT)
+                {
+                    return false;
+                }
+                break;
+
+            case 'b':
+                config.retain_bytes = atoll(optarg);
+                if (config.retain_bytes <= 0)
+                {
+                    return false;
+                }
+                break;
+
+            case 'n':
+                config.retain_segments = atoi(optarg);
+                if ((config.retain_segments <= 0) || (config.retain_segments > STORAGE_MAX_SEGMENTS))
+                {
+                    return false;
+                }
+                break;
+
+            case 'a':
+                config.retain_age = atoi(optarg);
+                if (config.retain_age <= 0)
+                {
+                    return false;
+                }
+                break;
+
+            case 'C':
+                config.max_connections = atoi(optarg);
+                if (config.max_connections <= 0)
+                {
+                    return false;
+                }
+                break;
+
+            case 'X':
+                if (atoll(optarg) <= 0)
+                {
+                    return false;
+                }
+                config.max_packet = atoll(optarg);
+                break;
+
+            case 'r':
+                if (atoll(optarg) <= 0)
+                {
+                    return false;
+                }
+                config.rate_bytes = atoll(optarg);
+                break;
+
+            case 'p':
+                config.rate_packets = atoi(optarg);
+                if (config.rate_packets <= 0)
+                {
+                    return false;
+                }
+                break;
+
+            case 'I':
+                config.idle_timeout = atoi(optarg);
+                if (config.idle_timeout <= 0)
+                {
+                    return false;
+                }
+                break;
+
+            case 'W':
+                config.stall_timeout = atoi(optarg);
+                if (config.stall_timeout <= 0)
+                {
+                    return false;
+                }
+                break;
+
+            default:
+                return false;
+        }
     }
 
-    size_t receive_buf_size = BUF_INITIAL_SIZE;
-    buf = malloc(receive_buf_size);
-    if (buf == NULL)
+    /* Retention applies to segments, which like mappings only the file backend has */
+    if ((config.segment_size == 0) &&
+        ((config.retain_bytes > 0) || (config.retain_age > 0) || (config.retain_segments != STORAGE_MAX_SEGMENTS)))
     {
-        syslog(LOG_ERR, "Memory allocation failed for receiving buffer");
-        goto threadfn_cleanup;
+        return false;
+    }
+#if (USE_AESD_CHAR_DEVICE == 1)
+    if ((config.segment_size > 0) || config.use_mmap || config.group_commit || (config.durability != DURABILITY_NONE))
+    {
+        return false;
     }
-    memset(buf, 0, receive_buf_size);
+#endif
 
-    if(receive_and_process_data(server_params, buf, receive_buf_size) != 0)
+    /* An appender waits for its batch to be written, which would stall an event loop and all its connections */
+    if (config.group_commit && (config.mode == SERVER_MODE_EPOLL))
     {
-        syslog(LOG_ERR, "receive_and_process_data failed");
+        return false;
     }
 
-threadfn_cleanup:
-    free(buf);
-    close(server_params->client_fd);
-    syslog(LOG_DEBUG, "Closed connection from %s", server_params->client_ip);
-    server_params->thread_complete = true;
+    /* Syncs are issued by the committer, strict replies wait on them */
+    if (config.sync_strict && (config.durability == DURABILITY_NONE))
+    {
+        return false;
+    }
+    /* A strict reply waits for fdatasync, the loop cannot, and -D brings in group commit anyway */
+    if ((config.durability != DURABILITY_NONE) && (config.mode == SERVER_MODE_EPOLL))
+    {
+        return false;
+    }
+    if (config.durability != DURABILITY_NONE)
+    {
+        config.group_commit = true;
+    }
 
-threadfn_server_exit:
-    return NULL;
+    /* A pool worker serves one connection at a time, idle keep-alive clients would hold every worker */
+    if (config.keep_alive && (config.mode == SERVER_MODE_POOL))
+    {
+        return false;
+    }
+
+    /* Only event loops have an accept loop each */
+    if (config.reuse_port && (config.mode != SERVER_MODE_EPOLL))
+    {
+        return false;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores <= 0)
+    {
+        cores = 1;
+    }
+    if (config.event_loops == 0)
+    {
+        config.event_loops = (int)cores;
+    }
+    if (config.workers == 0)
+    {
+        config.workers = (int)cores;
+    }
+
+    return true;
+}
+
+/* Create a helper thread that leaves SIGINT/SIGTERM to the main thread */
+int create_helper_thread(pthread_t *thread_id, void *(*start_routine)(void *), void *arg)
+{
+    sigset_t block_mask, orig_mask;
+    int ret;
+
+    sigemptyset(&block_mask);
+    sigaddset(&block_mask, SIGINT);
+    sigaddset(&block_mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block_mask, &orig_mask);
+    ret = pthread_create(thread_id, NULL, start_routine, arg);
+    pthread_sigmask(SIG_SETMASK, &orig_mask, NULL);
+
+    return ret;
 }
 
 int main ( int argc, char **argv )
 {
     openlog("socket", LOG_PID | LOG_CONS, LOG_USER);
-    bool is_daemon = false;
 
-    if ((argc >= 2) && strcmp(argv[1], "-d") == 0) 
+    if (!parse_args(argc, argv))
     {
-        is_daemon = true;
-    } 
+        print_usage(argv[0]);
+        closelog();
+        exit(1);
+    }
 
     /* Lines 363 - 382 were referenced from https://beej.us/guide/bgnet/html/ */
     int status;
@@ -457,34 +1078,40 @@ int main ( int argc, char **argv )
 
     if ((status = getaddrinfo(NULL, "9000", &hints, &res)) != 0) 
     {
-        syslog(LOG_ERR, "getaddrinfo failed");
+        aesd_log(LOG_ERR, "getaddrinfo failed");
         goto exit_on_fail;
     }
 
     /* Create a socket */
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1)
     {
-        syslog(LOG_ERR, "Failed to make a socket");
+        aesd_log(LOG_ERR, "Failed to make a socket");
         goto exit_on_fail;
     }
     
     /* Allow reuse of socket */
     if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) != 0)
     {
-        syslog(LOG_ERR, "Socket reuse failed");
+        aesd_log(LOG_ERR, "Socket reuse failed");
+        goto exit_on_fail;
+    }
+
+    /* The first of the per event loop listeners, the others join its port group */
+    if (config.reuse_port && (reactor_reuse_port(sockfd) != 0))
+    {
         goto exit_on_fail;
     }
 
     /* Bind it to the port we passed in to getaddrinfo(): */
     if (bind(sockfd, res->ai_addr, res->ai_addrlen) == -1) 
     {
-        syslog(LOG_ERR, "Bind failed");
-        syslog(LOG_ERR, "bind failed: %s", strerror(errno));
+        aesd_log(LOG_ERR, "Bind failed");
+        aesd_log(LOG_ERR, "bind failed: %s", strerror(errno));
         goto exit_on_fail;
     }
 
     /* Run as a daemon if specified */
-    if (is_daemon)
+    if (config.is_daemon)
     {
         bool daemon_status = create_daemon();
         if (!daemon_status)
@@ -495,10 +1122,13 @@ int main ( int argc, char **argv )
 
     if (listen(sockfd, BACKLOG) == -1)
     {
-        syslog(LOG_ERR, "Listen failed");
+        aesd_log(LOG_ERR, "Listen failed");
         goto exit_on_fail;
     }
 
+    /* Threads survive no fork, start the log drain thread in the daemon */
+    log_init();
+
     /* Setup signal handlers*/
     struct sigaction new_action;
     memset(&new_action, 0, sizeof(struct sigaction));
@@ -506,136 +1136,248 @@ int main ( int argc, char **argv )
 
     if (sigaction(SIGTERM, &new_action, NULL) != 0)
     {
-        syslog(LOG_ERR, "Sigaction for SIGTERM failed");
+        aesd_log(LOG_ERR, "Sigaction for SIGTERM failed");
     }
 
     if (sigaction(SIGINT, &new_action, NULL))
     {
-        syslog(LOG_ERR, "Sigaction for SIGINT failed");
+        aesd_log(LOG_ERR, "Sigaction for SIGINT failed");
     }
 
-    pthread_mutex_t tmp_file_write_mutex;
-    /* Create a mutex for synchronising writes to tmp_file*/
-    if(pthread_mutex_init(&tmp_file_write_mutex, NULL) != 0)
+    /* sendfile and splice have no MSG_NOSIGNAL, a peer reset or timeout shutdown must fail them with EPIPE */
+    new_action.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &new_action, NULL) != 0)
     {
-        syslog(LOG_ERR, "Creating file write mutex failed");
-        goto exit_on_fail;
+        aesd_log(LOG_ERR, "Sigaction for SIGPIPE failed");
     }
 
-    #if (USE_AESD_CHAR_DEVICE == 0)
-    time_thread_params_t *time_params = NULL;
-    time_params = (time_thread_params_t*)malloc(sizeof(time_thread_params_t));
-    if(time_params == NULL)
+    /* Fall back to plain syscalls when the kernel lacks io_uring */
+    if (config.use_uring && !uring_probe())
     {
-        syslog(LOG_ERR, "Malloc for time thread structure failed");
-        goto exit_on_fail;
+        aesd_log(LOG_INFO, "io_uring not supported, using the syscall I/O path");
+        config.use_uring = false;
     }
 
-    time_params->tmp_file_write_mutex = &tmp_file_write_mutex;
-    
-    if ((pthread_create(&(time_params->thread_id), NULL, &threadfn_timestamp, (void*)time_params)) != 0)
+    /* Start the uptime clock before the committer or any connection records statistics */
+    stats_init();
+
+    /* Open the shared storage descriptor, appends are ordered by offset reservation or the committer */
+    if (storage_init() != 0)
     {
-        syslog(LOG_ERR, "Timestamp thread creation failed");
+        aesd_log(LOG_ERR, "Storage setup failed");
         goto exit_on_fail;
     }
-    #endif
+
+    if (config.use_mirror)
+    {
+#if (USE_AESD_CHAR_DEVICE == 0)
+        if (config.segment_size > 0)
+        {
+            /* The mirror copies one file from offset 0, segments are dropped under it */
+            aesd_log(LOG_INFO, "Memory mirror is not used with log segments");
+        }
+        else if (mirror_init(storage_fd()) != 0)
+        {
+            aesd_log(LOG_ERR, "Memory mirror setup failed, replaying from the file");
+        }
+#else
+        /* The driver keeps its own bounded history and seek positions */
+        aesd_log(LOG_INFO, "Memory mirror is not used with %s", FILE_NAME);
+#endif
+    }
+
+    /* Periodic timestamps, served by the accept loop or the first event loop */
+    int timer_fd = timestamp_timer_create();
+
+    /* Statistics report, served next to the timer */
+    int stats_fd = stats_listen(config.stats_path);
 
     /* Initialize the head */
     head_t head;
-    SLIST_INIT(&head); 
+    LIST_INIT(&head); 
 
     /* Create the server thread*/
     server_thread_params_t *server_params = NULL;
+    aesd_pool_t *pool = NULL;
+
+    if (config.mode == SERVER_MODE_POOL)
+    {
+        pool = pool_create(config.workers);
+        if (pool == NULL)
+        {
+            aesd_log(LOG_ERR, "Worker pool creation failed");
+            goto exit_on_fail;
+        }
+    }
+    else if (config.mode == SERVER_MODE_EPOLL)
+    {
+        /* Event loops serve the listener until a signal is caught */
+        if (reactor_run(sockfd, timer_fd, stats_fd) != 0)
+        {
+            aesd_log(LOG_ERR, "Epoll event loops failed");
+        }
+    }
+
+    else
+    {
+        /* Finished connection threads wake the accept loop to be joined */
+        reap_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (reap_fd == ERROR)
+        {
+            aesd_log(LOG_ERR, "eventfd failed: %s", strerror(errno));
+            goto exit_on_fail;
+        }
+    }
+
+    timer_wheel_init(&conn_timers, stats_now());
 
     /* Now accept incoming connections in a loop while signal not caught*/
-    while (!caught_signal)
+    struct pollfd accept_fds[ACCEPT_FDS] = {
+        [ACCEPT_FD_LISTEN] = { .fd = sockfd, .events = POLLIN },
+        [ACCEPT_FD_TIMER] = { .fd = timer_fd, .events = POLLIN },  /* Ignored by poll when -1 */
+        [ACCEPT_FD_STATS] = { .fd = stats_fd, .events = POLLIN },
+        [ACCEPT_FD_REAP] = { .fd = reap_fd, .events = POLLIN },
+    };
+    while ((config.mode != SERVER_MODE_EPOLL) && !caught_signal)
     {
         int new_fd;
         char client_ip[INET_ADDRSTRLEN];     
+
+        /* A caught signal interrupts the wait with EINTR */
+        /* Connection threads arm deadlines behind our back, keep ticking while timeouts are on */
+        int poll_timeout = ((config.idle_timeout > 0) || (config.stall_timeout > 0)) ? TIMER_TICK_MS : -1;
+
+        if (poll(accept_fds, ACCEPT_FDS, poll_timeout) == ERROR)
+        {
+            if (errno != EINTR)
+            {
+                aesd_log(LOG_ERR, "Poll failed: %s", strerror(errno));
+            }
+            continue;
+        }
+        pthread_mutex_lock(&conn_timers_mutex);
+        timer_advance(&conn_timers, stats_now(), conn_timer_expired, NULL);
+        pthread_mutex_unlock(&conn_timers_mutex);
+
+        if (accept_fds[ACCEPT_FD_TIMER].revents & POLLIN)
+        {
+            timestamp_timer_fire(timer_fd);
+        }
+        if (accept_fds[ACCEPT_FD_STATS].revents & POLLIN)
+        {
+            stats_serve(stats_fd);
+        }
+        if (accept_fds[ACCEPT_FD_REAP].revents & POLLIN)
+        {
+            reap_finished_threads();
+        }
+        if (!(accept_fds[ACCEPT_FD_LISTEN].revents & POLLIN))
+        {
+            continue;
+        }
+
         addr_size = sizeof their_addr;
         new_fd = accept(sockfd, (struct sockaddr *)&their_addr, &addr_size);
         if (new_fd == -1)
         {
-            syslog(LOG_ERR, "Accept failed: %s", strerror(errno));
+            aesd_log(LOG_ERR, "Accept failed: %s", strerror(errno));
             continue;
         }
 
         inet_ntop(their_addr.ss_family, &(((struct sockaddr_in*)&their_addr)->sin_addr), client_ip, sizeof(client_ip));
-        syslog(LOG_DEBUG, "Accepted connection from %s", client_ip);
+        aesd_log(LOG_DEBUG, "Accepted connection from %s", client_ip);
+        stats_add(STATS_ACCEPTS, 1);
+        if (!admission_accept(client_ip))
+        {
+            close(new_fd);
+            continue;
+        }
+        stats_add(STATS_CONNECTIONS_ACTIVE, 1);
 
         server_params = (server_thread_params_t*)malloc(sizeof(server_thread_params_t));
         if(server_params == NULL)
         {
-            syslog(LOG_ERR, "Malloc for server thread params failed");
+            aesd_log(LOG_ERR, "Malloc for server thread params failed");
+            close(new_fd);
+            stats_add(STATS_CONNECTIONS_ACTIVE, -1);
+            admission_release();
             continue;
         }
 
-        server_params->thread_complete = false;
         server_params->client_fd = new_fd;
         strncpy(server_params->client_ip, client_ip, INET_ADDRSTRLEN);
-        server_params->tmp_file_write_mutex = &tmp_file_write_mutex;
+        server_params->timer.armed = false;
+        server_params->timer.data = server_params;
+
+        if (config.mode == SERVER_MODE_POOL)
+        {
+            /* Hand the connection to a pre-spawned worker, no thread creation */
+            if (!pool_submit(pool, pool_task_server, (void*)server_params))
+            {
+                aesd_log(LOG_ERR, "Worker pool full, dropping connection from %s", client_ip);
+                close(new_fd);
+                stats_add(STATS_CONNECTIONS_ACTIVE, -1);
+                admission_release();
+                free(server_params);
+            }
+            server_params = NULL;
+            continue;
+        }
         
-        if ((pthread_create(&(server_params->thread_id), NULL, threadfn_server, (void*)server_params)) != 0)
+        if (create_helper_thread(&(server_params->thread_id), threadfn_connection, (void*)server_params) != 0)
         {
-            syslog(LOG_ERR, "Thread creation failed");
+            aesd_log(LOG_ERR, "Thread creation failed");
+            close(new_fd);
+            stats_add(STATS_CONNECTIONS_ACTIVE, -1);
+            admission_release();
             free(server_params);
             server_params = NULL;
             continue;
         }
 
-        /* Add the node to the SLIST*/
-        SLIST_INSERT_HEAD(&head, server_params, link);
-
-        /* Attempt to join threads by checking for the complete_thread flag*/
-        server_thread_params_t *iterator = NULL;
-        server_thread_params_t *tmp = NULL;
-
-        SLIST_FOREACH_SAFE(iterator, &head, link, tmp) 
-	    {
-            if (iterator->thread_complete == true) 
-	        {
-                if(pthread_join(iterator->thread_id, NULL) != 0)
-		        {
-                    syslog(LOG_ERR, "Thread join failed for %ld", iterator->thread_id);
-                }
-                syslog(LOG_INFO, "Thread joined %ld", iterator->thread_id);
-
-                /* Remove node from the list and free the memory */
-                SLIST_REMOVE(&head, iterator, server_thread_params, link);
-                free(iterator);
-                iterator = NULL;
-            }
-        }
+        /* Add the node to the list, the thread queues it for joining when done */
+        LIST_INSERT_HEAD(&head, server_params, link);
     }
 
     /* Cleanup after caught signal */
-    /* Mutex */
-    pthread_mutex_destroy(&tmp_file_write_mutex);
-    #if (USE_AESD_CHAR_DEVICE == 0)
-    /* Timestamp thread */
-    pthread_cancel(time_params->thread_id);
-    pthread_join(time_params->thread_id, NULL);
-    free(time_params);
-    #endif
+    /* Worker pool, finishes the connections already queued */
+    pool_destroy(pool);
+    /* Timestamp timer and statistics socket */
+    if (timer_fd != -1)
+    {
+        close(timer_fd);
+    }
+    stats_close(stats_fd, config.stats_path);
     /* Server thread */
     server_thread_params_t *iterator = NULL;
     server_thread_params_t *tmp = NULL;
-    SLIST_FOREACH_SAFE(iterator, &head, link, tmp) 
+    LIST_FOREACH_SAFE(iterator, &head, link, tmp) 
     {
         if(pthread_join(iterator->thread_id, NULL) != 0)
         {
-            syslog(LOG_ERR, "Thread join failed for %ld", iterator->thread_id);
+            aesd_log(LOG_ERR, "Thread join failed for %ld", iterator->thread_id);
         }
-        syslog(LOG_INFO, "Thread joined %ld", iterator->thread_id);
+        aesd_log(LOG_INFO, "Thread joined %ld", iterator->thread_id);
 
         /* Remove node from the list and free the memory */
-        SLIST_REMOVE(&head, iterator, server_thread_params, link);
+        LIST_REMOVE(iterator, link);
         free(iterator);
         iterator = NULL;
     }
+    /* Every node on the completion stack was on the list and is freed */
+    atomic_store(&done_head, NULL);
+    if (reap_fd != -1)
+    {
+        close(reap_fd);
+    }
+
+    mirror_destroy();
+    storage_destroy();
+    bufpool_destroy();
 
 exit_on_fail:
     cleanup();
+    log_destroy();
     closelog();
     exit(1);
 }
\ No newline at end of file
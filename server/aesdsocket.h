@@ -0,0 +1,108 @@
+/*******************************************************************************
+ * Copyright (C) 2024 by Trapti Damodar Balgi
+ *
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users are
+ * permitted to modify this and use it to learn about the field of embedded
+ * software. Trapti Damodar Balgi and the University of Colorado are not liable for
+ * any misuse of this material.
+ * ****************************************************************************/
+
+/**
+ * @file    aesdsocket.h
+ * @brief   Definitions shared between the aesdsocket server modules
+ *
+ * @author  Trapti Damodar Balgi
+ * @date    10/16/2026
+ */
+
+#ifndef AESDSOCKET_H
+#define AESDSOCKET_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define ERROR (-1)
+#define BUF_INITIAL_SIZE (1024)
+#define BACKLOG (10)
+
+/* Build switch, can be overridden from the command line with -DUSE_AESD_CHAR_DEVICE=0 */
+#ifndef USE_AESD_CHAR_DEVICE
+#define USE_AESD_CHAR_DEVICE (1)
+#endif
+
+#if (USE_AESD_CHAR_DEVICE == 1)
+    #define FILE_NAME "/dev/aesdchar"
+#elif (USE_AESD_CHAR_DEVICE == 0)
+	#define FILE_NAME "/var/tmp/aesdsocketdata"
+#endif
+
+#define AESD_SEEK_CMD "AESDCHAR_IOCSEEKTO:"
+
+/* File backend: "AESDRESUME:<offset>\n" replays from offset and ends with a cursor line */
+#define AESD_RESUME_CMD "AESDRESUME:"
+#define AESD_CURSOR_FMT "AESDCURSOR:%lld\n"
+#define AESD_CURSOR_SIZE (32)
+
+/* Connection handling model selected at startup */
+typedef enum
+{
+    SERVER_MODE_THREAD = 0,     /* One thread per accepted connection */
+    SERVER_MODE_POOL,           /* Pre-spawned worker pool fed by the accept loop */
+    SERVER_MODE_EPOLL,          /* Fixed set of epoll event loop threads */
+} server_mode_t;
+
+/* When appended data is forced to disk, every policy but none runs the committer */
+typedef enum
+{
+    DURABILITY_NONE = 0,        /* Left to the kernel's writeback */
+    DURABILITY_INTERVAL,        /* fdatasync every STORAGE_SYNC_INTERVAL_MS */
+    DURABILITY_BATCH,           /* fdatasync after every group commit batch */
+    DURABILITY_PACKET,          /* fdatasync after every append, batches of one */
+} durability_t;
+
+/* Runtime configuration parsed from the command line */
+typedef struct aesd_config
+{
+    bool is_daemon;
+    server_mode_t mode;
+    int event_loops;            /* Number of event loop threads in epoll mode */
+    bool reuse_port;            /* One SO_REUSEPORT listener per event loop, pinned to a core */
+    int workers;                /* Number of worker threads in pool mode */
+    bool use_uring;             /* io_uring I/O engine for thread and pool modes */
+    bool use_mirror;            /* Serve replays from the in-memory log mirror */
+    bool use_mmap;              /* Serve replays from read-only mappings of the log files */
+    size_t replay_flush;        /* Bytes gathered per replay send, replays above it are corked */
+    bool keep_alive;            /* Serve packets until the client closes instead of one per connection */
+    bool coalesce_replay;       /* One replay per batch of pipelined packets (keep-alive only) */
+    int timestamp_interval;     /* Seconds between timestamp records, 0 disables them */
+    int log_level;              /* Most verbose syslog level logged, LOG_INFO by default */
+    const char *stats_path;     /* UNIX socket serving the statistics report, empty disables it */
+    off_t segment_size;         /* Bytes per log segment file, 0 keeps the single FILE_NAME */
+    off_t retain_bytes;         /* Drop old segments once the log is this long, 0 keeps all */
+    int retain_segments;        /* Segment files kept at most */
+    int retain_age;             /* Drop segments older than this many seconds, 0 keeps all */
+    bool group_commit;          /* Appends are queued and written in batches by one committer thread */
+    durability_t durability;    /* When the committer syncs the log */
+    bool sync_strict;           /* An append returns only once a sync covers it */
+    int max_connections;        /* Connections open at once, 0 for no limit */
+    size_t max_packet;          /* Longest packet or binary record accepted, 0 for no limit */
+    size_t rate_bytes;          /* Bytes per second received from one client_ip, 0 for no limit */
+    int rate_packets;           /* Packets per second served to one client_ip, 0 for no limit */
+    int idle_timeout;           /* Seconds a connection may wait for data, 0 for no limit */
+    int stall_timeout;          /* Seconds a replay may make no progress, 0 for no limit */
+} aesd_config_t;
+
+extern aesd_config_t config;
+extern volatile sig_atomic_t caught_signal;
+
+/**
+ * pthread_create wrapper that blocks SIGINT/SIGTERM in the new thread so the
+ * main thread is the one interrupted when a signal is caught.
+ */
+int create_helper_thread(pthread_t *thread_id, void *(*start_routine)(void *), void *arg);
+
+#endif /* AESDSOCKET_H */
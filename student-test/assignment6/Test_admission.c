@@ -0,0 +1,75 @@
+#include "unity.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <syslog.h>
+#include "../../server/aesdsocket.h"
+#include "../../server/aesd-admission.h"
+#include "../../server/aesd-stats.h"
+
+/* What aesd-admission.c links against in aesdsocket, with a clock the tests move by hand */
+aesd_config_t config = { .log_level = LOG_ERR };
+static uint64_t fake_now = 1000000000ULL;
+static int64_t rejects = 0;
+
+uint64_t stats_now(void)
+{
+    return fake_now;
+}
+
+void stats_add(stats_counter_t counter, int64_t delta)
+{
+    if (counter == STATS_REJECTED)
+    {
+        rejects += delta;
+    }
+}
+
+void log_write(int level, const char *format, ...)
+{
+    (void)level;
+    (void)format;
+}
+
+/**
+* A packet more than one second of rate_bytes long must be received over several
+* deferred reads, never leaving the address further behind than ADMISSION_MAX_DEFER_MS.
+*/
+void test_admission_large_packet_is_deferred()
+{
+    const char *client_ip = "192.0.2.1";
+    size_t remaining = 5000;
+    int reads = 0;
+
+    config.rate_bytes = 2000;
+    rejects = 0;
+
+    while (remaining > 0)
+    {
+        uint64_t delay = admission_delay(client_ip);
+        TEST_ASSERT_TRUE_MESSAGE(delay <= (uint64_t)ADMISSION_MAX_DEFER_MS * 1000000ULL,
+                                 "A single receive put the client past the deferral cap");
+        fake_now += delay;
+
+        size_t length = admission_recv_size(remaining);
+        TEST_ASSERT_TRUE_MESSAGE(length <= (size_t)config.rate_bytes, "A receive may fill more than the bucket");
+        admission_charge(client_ip, length, 0);
+        remaining -= length;
+        reads++;
+    }
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(3, reads, "5000 bytes at 2000 bytes per second take three reads");
+    TEST_ASSERT_TRUE_MESSAGE(admission_accept(client_ip), "The address should still be admitted");
+    admission_release();
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, (int)rejects, "Nothing should have been rejected");
+    config.rate_bytes = 0;
+}
+
+/**
+* Without a byte rate a receive may fill all the space it is given.
+*/
+void test_admission_recv_size_unlimited()
+{
+    config.rate_bytes = 0;
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(65536, admission_recv_size(65536), "No rate should not cap a receive");
+}